@@ -55,7 +55,7 @@
 #define configTIMER_TASK_PRIORITY       2
 #define configTIMER_QUEUE_LENGTH        10
 #define configTIMER_TASK_STACK_DEPTH    64
-#define configUSE_TIMERS                1
+#define configUSE_TIMERS                0
 
 /* Set the following definitions to 1 to include the API function, or zero
 to exclude the API function. */
@@ -82,5 +82,14 @@ configKERNEL_INTERRUPT_PRIORITY setting.  Here 15 corresponds to the lowest
 NVIC value of 255. */
 #define configLIBRARY_KERNEL_INTERRUPT_PRIORITY	15
 
+/* Host simulation build (FreeRTOS POSIX port): simulated peripherals are 
+serviced from the tick hook, tasks run as threads and need more heap. */
+#ifdef VOLTMETER_POSIX_PORT
+#undef configUSE_TICK_HOOK
+#define configUSE_TICK_HOOK		1
+#undef configTOTAL_HEAP_SIZE
+#define configTOTAL_HEAP_SIZE		( ( size_t ) ( 256 * 1024 ) )
+#endif /* VOLTMETER_POSIX_PORT */
+
 #endif /* FREERTOS_CONFIG_H */
 
@@ -18,11 +18,28 @@
 void LEDBlinkTask                       (void * parameters);
 void UartRxTask                         (void * parameters);
 void VoltmeterRoutineTask               (void * parameters);
-void UartTxTask                         (void * parameters);
 void AdcTestTask                        (void * parameters);
 
+void UartRxEventHandler                 (const stm32uart::UartHardwareNumber uart_number);
+
 bool InitRCC();
 
+static TaskHandle_t uart_rx_task_handle = NULL;
+static TaskHandle_t voltmeter_task_handle = NULL;
+
+#ifdef VOLTMETER_POSIX_PORT
+
+namespace stm32adc { extern void portServiceSimulation(); }
+namespace stm32uart { extern void portServiceSimulation(); }
+
+  //Host simulation: peripheral models raise their interrupts from tick interrupt
+extern "C" void vApplicationTickHook(void){
+  stm32adc::portServiceSimulation();
+  stm32uart::portServiceSimulation();
+}
+
+#endif  //VOLTMETER_POSIX_PORT
+
 int main(){
   
   //Initialisation of RCC
@@ -47,21 +64,16 @@ int main(){
               256,
               NULL,
               tskIDLE_PRIORITY + 2,
-              NULL);    
-
-  xTaskCreate(UartTxTask,
-              "",
-              256,
-              NULL,
-              tskIDLE_PRIORITY + 2,
-              NULL);    
+              &uart_rx_task_handle);    
 
   xTaskCreate(VoltmeterRoutineTask,
               "",
               512,
               NULL,
               tskIDLE_PRIORITY + 1,
-              NULL);
+              &voltmeter_task_handle);
+  
+  stm32uart::SetRxEventHandler( stm32uart::kUart1, UartRxEventHandler );
 
   vTaskStartScheduler();
   
@@ -106,39 +118,38 @@ void LEDBlinkTask(void * parameters){
   };
 }
 
-void UartRxTask( void * parameters){
-  const int kUartRxPeriod = 100;
-  TickType_t xLastWakeTime = xTaskGetTickCount();
-  for( ; ; ){
-    RxRoutine( stm32uart::kUart1 );
-    vTaskDelayUntil( &xLastWakeTime, kUartRxPeriod ); 
-  }
+  //Called from uart interrupt: line became idle or half of rx buffer is filled
+void UartRxEventHandler(const stm32uart::UartHardwareNumber uart_number){
+  BaseType_t higher_priority_task_woken = pdFALSE;
+  
+  if(uart_rx_task_handle != NULL)
+    vTaskNotifyGiveFromISR( uart_rx_task_handle, &higher_priority_task_woken );
+  
+  portYIELD_FROM_ISR( higher_priority_task_woken );
 }
 
-void UartTxTask( void * parameters){
-  const int kUartTxPeriod = 50;
-  TickType_t xLastWakeTime = xTaskGetTickCount();
+void UartRxTask( void * parameters){
   for( ; ; ){
-    TxRoutine( stm32uart::kUart1 );
-    vTaskDelayUntil( &xLastWakeTime, kUartTxPeriod ); 
+    ulTaskNotifyTake( pdTRUE, portMAX_DELAY );
+    RxRoutine( stm32uart::kUart1 );
+    xTaskNotifyGive( voltmeter_task_handle );
   }
 }
 
-
 void VoltmeterRoutineTask(void * parameters){
+  //state is updated at least with this period, messages are processed as soon as received
   const int kVoltmeterTaskPeriod = 100;  
-  TickType_t xLastWakeTime = xTaskGetTickCount();
   stm32uart::SendMessage(stm32uart::kUart1, "Voltmeter started");
   for( ; ; ){
     std::string new_message = "";
 
-    if(GetPendingMessage( stm32uart::kUart1 , &new_message ) == stm32uart::kOk){
+    while(GetPendingMessage( stm32uart::kUart1 , &new_message ) == stm32uart::kOk){
       voltmeter::Voltmeter::IncomingMessage(new_message);
     }
     
     voltmeter::Voltmeter::UpdateState();
     
-    vTaskDelayUntil( &xLastWakeTime, kVoltmeterTaskPeriod );
+    ulTaskNotifyTake( pdTRUE, kVoltmeterTaskPeriod );
   }
 }
 
@@ -148,6 +159,11 @@ void VoltmeterRoutineTask(void * parameters){
 
 bool InitRCC(){
 
+#ifdef VOLTMETER_POSIX_PORT
+  //nothing to setup on host
+  return true;
+#endif  //VOLTMETER_POSIX_PORT
+
   RCC->CR |= (1<<RCC_CR_HSEON_Pos); //Start HSE
   
   for(int i = 0; ; i++)
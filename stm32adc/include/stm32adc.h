@@ -13,11 +13,23 @@ typedef enum {  kOk,
                 kChannelsLimitReached,
                 kChannelNotActive,
                 kChannelAlreadyActive,
+                kValueNotReady,
+                kRateNotAchievable,
                 kError   }              ReturnState;
 
 typedef enum {  kAdc1,  
+                kAdc2,
                 kAdc3    }              AdcHardwareNumber;
 
+  //Mode of ADC pair (ADC1 is master, ADC2 is slave). Set in configuration of master
+  //kRegularSimultaneousMode    : channels of scan list are converted by pairs at the same instant:
+  //                              1st with 2nd, 3rd with 4th and so on (even positions by master, odd by slave)
+  //kFastInterleavedMode        : single channel is converted by both ADC in turn, at doubled rate
+  //                              (ADC clock / 7), sample rate of configuration is not used
+typedef enum {  kIndependentMode,
+                kRegularSimultaneousMode,
+                kFastInterleavedMode  } DualMode;
+
 typedef enum {  kCh0, kCh1, 
                 kCh2, kCh3, 
                 kCh4, kCh5, 
@@ -26,17 +38,105 @@ typedef enum {  kCh0, kCh1,
                 kCh10, kCh11, 
                 kCh12, kCh13, 
                 kCh14, kCh15,
+                kCh16, kCh17,
                 kNoChannel,}       AdcChannel;  
 
-typedef unsigned short AdcValue;
+  //sampling time of a channel in ADC clock cycles, in order of SMPx register codes
+  //Conversion of a channel takes sampling time + 12.5 cycles
+typedef enum {  kSampleTime1_5,
+                kSampleTime7_5,
+                kSampleTime13_5,
+                kSampleTime28_5,
+                kSampleTime41_5,
+                kSampleTime55_5,
+                kSampleTime71_5,
+                kSampleTime239_5  }     SampleTime;
+
+  //divider of ADC clock (ADCCLK = PCLK2 / divider), in order of ADCPRE register codes
+typedef enum {  kAdcPrescaler2,
+                kAdcPrescaler4,
+                kAdcPrescaler6,
+                kAdcPrescaler8    }     AdcPrescaler;
+
+  //raw result of a single conversion, as written by DMA
+typedef unsigned short AdcSample;
+  //value reported by Adc: raw sample, or extended precision value of oversampled channel
+typedef unsigned long AdcValue;
+typedef int SampleRate;
+  //oversampled value is sum of 4^order samples, shifted right by order
+typedef int OversamplingOrder;
+  //supply voltage of ADC (VDDA), millivolts
+typedef unsigned long SupplyVoltage;
+  //ratio of VDDA to its nominal value, fixed point with kSupplyCorrectionShift fractional bits
+typedef unsigned long SupplyCorrection;
+  //CPU cycles (DWT cycle counter on target), extended to 64 bits, see GetTimestampFrequency()
+  //Time base is continuous while scan list runs
+typedef unsigned long long Timestamp;
 
 struct AdcConfiguration {
   int max_simultaneously_scanned_channels = adc_configDEFAULT_MAX_SIMULTANEOUSLY_SCANNED_CHANNELS;
+  SampleRate sample_rate = adc_configDEFAULT_SAMPLE_RATE;
+  int block_length = adc_configDEFAULT_BLOCK_LENGTH;
+  AdcPrescaler adc_prescaler = adc_configDEFAULT_ADC_PRESCALER;
+  DualMode dual_mode = kIndependentMode;
 };
 
+  //Samples of one channel within completed block
+  //i-th sample is located at first[i * stride], it was triggered at timestamp + i * interval
+struct ChannelSamples {
+  const AdcSample* first;
+  int stride;
+  int amount;
+  Timestamp timestamp;
+  unsigned long interval;               //CPU cycles
+};
+
+  //Calibrations of ADC: the one at initialisation and scheduled ones (see adc_configRECALIBRATION_PERIOD_MS)
+struct CalibrationStatistics {
+  unsigned long completed;
+  unsigned long postponed;              //scheduled calibration did not fit before next trigger, it is retried at next block
+  unsigned long last_duration_ns;       //ADC is not converting meanwhile
+  unsigned long max_duration_ns;
+  unsigned long calibration_code;       //offset correction, found by the last calibration
+};
+
+  //Timing of delivered blocks. Block time is the trigger of its last sequence: it is taken from trigger timer,
+  //so neither interrupt latency nor its jitter affect timestamps
+struct TimingStatistics {
+  unsigned long blocks;                 //delivered since scanning was started
+  unsigned long gaps;                   //blocks, whose period was far from nominal (e.g. block interrupt was held too long)
+  unsigned long nominal_period_ns;
+  unsigned long min_period_ns;          //measured period of consecutive blocks, max - min is jitter of triggers
+  unsigned long max_period_ns;
+  unsigned long last_latency_ns;        //from block time till block interrupt
+  unsigned long max_latency_ns;
+};
+
+  //Called from interrupt context each time a block of samples is completed
+  //Samples stay valid until return: DMA meanwhile fills the other half of the buffer
+typedef void (*SamplesHandler)(void* context, const ChannelSamples &samples);
+
+typedef enum {  kBelowLowThreshold,
+                kAboveHighThreshold   }     ThresholdCrossing;
+
+  //Called from interrupt context, when sample of -channel- leaves the range between thresholds
+  //It is called once per leaving: sample must return into the range (or cross the other threshold) to be reported again
+typedef void (*ThresholdHandler)(void* context, const AdcChannel channel, const ThresholdCrossing crossing, const AdcSample sample);
+
 constexpr AdcConfiguration kDefaultAdcConfiguration;
 constexpr AdcValue kInvalidValue = 0;
 constexpr AdcValue kMaxAdcValue = 4095;
+constexpr OversamplingOrder kMaxOversamplingOrder = adc_configMAX_OVERSAMPLING_ORDER;
+  //channels converted at once by ConvertChannelsOnce() (length of injected sequence)
+constexpr int kMaxInjectedChannels = 4;
+constexpr int kSupplyCorrectionShift = 16;
+constexpr SupplyCorrection kUnitySupplyCorrection = 1UL << kSupplyCorrectionShift;
+constexpr SupplyVoltage kNominalSupplyVoltage = adc_configNOMINAL_VDDA_MILLIVOLTS;
+
+  //full scale of values with oversampling of order -order-
+constexpr AdcValue MaxAdcValue(const OversamplingOrder order){
+  return ((kMaxAdcValue + 1) << order) - 1;
+}
 
 
 
@@ -46,6 +146,8 @@ constexpr AdcValue kMaxAdcValue = 4095;
 
   //Initialisation of Adc
   //-configuration- can be replaced by default constant kDefaultAdcConfiguration
+  //With dual mode, slave ADC is initialised together with master, and it is not used separately.
+  //Slave itself can not be initialised, if port does not support it standalone (no DMA request of ADC2 on stm32f103)
   //            Possible returns:
   //    kOk                     : initialised successfuly
   //    kError                  : not initialised due to some error
@@ -55,11 +157,14 @@ ReturnState InitAdc(const AdcHardwareNumber adc_number, const AdcConfiguration &
   //Adds -new_channel- to scan list of Adc -adc_number-
   //It means that this channel will be measured regulary
   //and its value is available at any time
+  //If other channels are scanned, new scan list is applied at the next buffer wrap:
+  //their samples are not interrupted, new channel reports kValueNotReady till then
   //            Possible returns:
   //    kOk                     : channel successfuly added to scan list
   //    kkAdcNotInitialised     : ch not added due to respective Adc was not initialized
   //    kChannelAlreadyActive   : channel was already added, nothing to do
-  //    kChannelsLimitReached   : not added due to channels limit reached
+  //    kChannelsLimitReached   : not added due to channels limit reached, or scan list with this channel
+  //                              would not be converted within one sample period (see GetAchievableSampleRate())
   //    kError                  : non added due to some other error
 ReturnState AddChannelToScanList(const AdcHardwareNumber adc_number, const AdcChannel new_channel);
 
@@ -72,11 +177,62 @@ ReturnState AddChannelToScanList(const AdcHardwareNumber adc_number, const AdcCh
   //    kOk                     : Value is be stored on -*value- address
   //    kkAdcNotInitialised     : value is invalid due to Adc was not initialized
   //    kChannelNotActive       : value is invalid due to channel was not added to scan list
+  //    kValueNotReady          : channel is just added and not yet converted,
+  //                              or it is oversampled, and its first value is not yet accumulated
   //    kError                  : other error, value is invalid
 ReturnState GetCurrentValue(const AdcHardwareNumber adc_number, const AdcChannel channel, AdcValue *value);
 
 
+  //Converts -channels_amount- (up to kMaxInjectedChannels) channels -channels- of Adc -adc_number- once,
+  //waits for the end of conversion and stores results to -values- in the same order
+  //Channels need not be in scan list. Conversion is injected: it preempts scan sequence, which then resumes,
+  //so that scanned channels keep their sample rate. Sampling time is the one set by SetChannelSampleTime()
+  //            Possible returns:
+  //    kOk                     : values are stored
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kRateNotAchievable      : scan list, delayed by this conversion, would not be converted within one sample period
+  //    kError                  : channel is not available, Adc is in fast interleaved mode, conversion timeout or other error
+ReturnState ConvertChannelsOnce(const AdcHardwareNumber adc_number, const AdcChannel* channels, const int channels_amount, AdcValue* values);
+
+
+  //Sets oversampling of channel -channel- of Adc -adc_number-
+  //Each value, returned by GetCurrentValue(), is then the sum of 4^-order- consecutive samples 
+  //shifted right by -order-, i.e. it has 12 + -order- bits (full scale is MaxAdcValue(-order-))
+  //New value is ready every 4^-order- sample periods. Order 0 switches oversampling off
+  //Samples delivered to subscribers are not affected. Oversampling is reset, when channel is removed from scan list
+  //            Possible returns:
+  //    kOk                     : oversampling is set
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kChannelNotActive       : channel was not added to scan list
+  //    kError                  : -order- exceeds kMaxOversamplingOrder, or other error
+ReturnState SetChannelOversampling(const AdcHardwareNumber adc_number, const AdcChannel channel, const OversamplingOrder order);
+
+
+  //Sets sampling time of channel -channel- of Adc -adc_number-
+  //Short time suits low impedance sources and leaves room for more channels at given sample rate,
+  //long time is needed for high impedance ones. Default is adc_configDEFAULT_SAMPLE_TIME
+  //May be set before channel is added. For running scan list it is applied at the next buffer wrap
+  //            Possible returns:
+  //    kOk                     : sampling time is set
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kRateNotAchievable      : not set, scan list would not be converted within one sample period
+  //    kError                  : channel is not available, Adc is in fast interleaved mode, or other error
+ReturnState SetChannelSampleTime(const AdcHardwareNumber adc_number, const AdcChannel channel, const SampleTime sample_time);
+
+
+  //Sets ADC clock prescaler of Adc -adc_number-. Default is taken from configuration
+  //For running scan list it is applied at the next buffer wrap
+  //            Possible returns:
+  //    kOk                     : prescaler is set
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kRateNotAchievable      : not set, ADC clock would exceed its limit,
+  //                              or scan list would not be converted within one sample period
+  //    kError                  : Adc is in fast interleaved mode, or other error
+ReturnState SetAdcPrescaler(const AdcHardwareNumber adc_number, const AdcPrescaler prescaler);
+
+
   //Removes adc channel -channel_to_remove- from Adc -adc_number- scan list
+  //As with adding, running scan list is switched at the next buffer wrap
  
   //            Possible returns:
   //    kOk                     : Successfuly removed
@@ -84,6 +240,143 @@ ReturnState GetCurrentValue(const AdcHardwareNumber adc_number, const AdcChannel
   //    kError                  : other error
 ReturnState RemoveChannelFromScanList(const AdcHardwareNumber adc_number, const AdcChannel channel_to_remove);
 
+
+  //Subscribes -handler- to samples of channel -channel- of Adc -adc_number-
+  //Every time a block of scan sequences (half of ping-pong buffer) is completed, 
+  //-handler- is called from interrupt with -context- and samples of -channel- from this block
+  //In fast interleaved mode block holds two samples per sequence (stride 1)
+  //Channel should be added to scan list separately
+  //            Possible returns:
+  //    kOk                     : subscribed successfuly
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kError                  : other error
+ReturnState SubscribeToChannelSamples(const AdcHardwareNumber adc_number, 
+                                      const AdcChannel channel, 
+                                      const SamplesHandler handler, 
+                                      void* context);
+
+
+  //Removes all subscriptions with -context- to channel -channel- of Adc -adc_number-
+  //After return -handler- is guaranteed not to be called with -context-
+  //            Possible returns:
+  //    kOk                     : Successfuly unsubscribed
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kError                  : other error
+ReturnState UnsubscribeFromChannelSamples(const AdcHardwareNumber adc_number, const AdcChannel channel, void* context);
+
+
+  //Gets rate (samples per second of each scanned channel) of Adc -adc_number-
+  //In fast interleaved mode it is the rate of both ADC together
+  //            Possible returns:
+  //    kOk                     : rate is stored on -*rate- address
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+ReturnState GetSampleRate(const AdcHardwareNumber adc_number, SampleRate *rate);
+
+
+  //Gets highest sample rate, at which current scan list of Adc -adc_number- is converted
+  //within one sample period, considering sampling time of each channel and ADC clock
+  //0 is stored, if scan list is empty
+  //            Possible returns:
+  //    kOk                     : rate is stored on -*rate- address
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+ReturnState GetAchievableSampleRate(const AdcHardwareNumber adc_number, SampleRate *rate);
+
+
+  //Gets maximum amount of channels, which can be simultaneously scanned by Adc -adc_number-
+  //Depends on configuration (buffer size) and on conversion time at current sample rate:
+  //channels of current scan list plus channels of default sampling time, which would still fit
+  //            Possible returns:
+  //    kOk                     : amount is stored on -*capacity- address
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+ReturnState GetChannelsCapacity(const AdcHardwareNumber adc_number, int *capacity);
+
+
+  //Gets filtered estimate of supply voltage VDDA of Adc -adc_number-, measured by internal reference (VREFINT)
+  //Reference is converted in background every adc_configSUPPLY_UPDATE_PERIOD_MS, while scan list is not empty,
+  //unless scan list takes the whole sample period. Only Adc with internal channels (ADC1) measures it
+  //            Possible returns:
+  //    kOk                     : voltage is stored on -*vdda- address
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kValueNotReady          : reference is not yet converted, nominal voltage is stored
+ReturnState GetSupplyVoltage(const AdcHardwareNumber adc_number, SupplyVoltage *vdda);
+
+
+  //Gets ratio of VDDA estimate to nominal VDDA (adc_configNOMINAL_VDDA_MILLIVOLTS), 
+  //kUnitySupplyCorrection stands for 1. Sample, multiplied by it, is as if it were converted with nominal VDDA
+  //Ratio is updated together with estimate, reading it costs nothing
+  //            Possible returns:
+  //    kOk                     : ratio is stored on -*correction- address
+  //    kkAdcNotInitialised     : error: Adc was not initialized, kUnitySupplyCorrection is stored
+  //    kValueNotReady          : reference is not yet converted, kUnitySupplyCorrection is stored
+ReturnState GetSupplyCorrection(const AdcHardwareNumber adc_number, SupplyCorrection *correction);
+
+
+  //Sets hardware analog watchdog of Adc -adc_number-: -handler- is called from ADC interrupt right after 
+  //conversion of sample outside [-low_threshold-; -high_threshold-] (raw samples), i.e. microseconds after crossing
+  //-channel- is the watched channel, kNoChannel watches all scanned channels (in dual mode: channels of master)
+  //After report, watchdog interrupt is disabled until all watched samples of a block are back within thresholds
+  //There is one watchdog per Adc, new settings replace previous ones
+  //            Possible returns:
+  //    kOk                     : watchdog is set
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kError                  : wrong thresholds or channel, no handler, or Adc has no watchdog
+ReturnState SetAnalogWatchdog(const AdcHardwareNumber adc_number, 
+                              const AdcChannel channel, 
+                              const AdcSample low_threshold, 
+                              const AdcSample high_threshold,
+                              const ThresholdHandler handler,
+                              void* context);
+
+
+  //Switches hardware analog watchdog of Adc -adc_number- off
+  //            Possible returns:
+  //    kOk                     : watchdog is off
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+ReturnState ClearAnalogWatchdog(const AdcHardwareNumber adc_number);
+
+
+  //Sets thresholds of channel -channel- of Adc -adc_number- in software threshold engine:
+  //each sample of channel is checked in block interrupt, -handler- is called when it leaves [-low_threshold-; -high_threshold-]
+  //Unlike watchdog, any amount of channels may be watched, but crossing is reported only at the end of block
+  //Thresholds are kept, while channel is not scanned, and work again, when it is added to scan list
+  //            Possible returns:
+  //    kOk                     : thresholds are set
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+  //    kError                  : wrong thresholds or channel, or no handler
+ReturnState SetChannelThresholds(const AdcHardwareNumber adc_number, 
+                                 const AdcChannel channel, 
+                                 const AdcSample low_threshold, 
+                                 const AdcSample high_threshold,
+                                 const ThresholdHandler handler,
+                                 void* context);
+
+
+  //Removes thresholds of channel -channel- of Adc -adc_number- from software threshold engine
+  //            Possible returns:
+  //    kOk                     : thresholds are removed (or there were none)
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+ReturnState ClearChannelThresholds(const AdcHardwareNumber adc_number, const AdcChannel channel);
+
+
+  //Gets statistics of calibrations of Adc -adc_number-
+  //Scheduled calibration is done between two scan sequences, so that no sample is lost or delayed
+  //It is not scheduled in fast interleaved mode: ADC never stops there
+  //            Possible returns:
+  //    kOk                     : statistics are stored on -*statistics- address
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+ReturnState GetCalibrationStatistics(const AdcHardwareNumber adc_number, CalibrationStatistics *statistics);
+
+
+  //Gets timing statistics of blocks of Adc -adc_number-, they are restarted, when scanning is started
+  //            Possible returns:
+  //    kOk                     : statistics are stored on -*statistics- address
+  //    kkAdcNotInitialised     : error: Adc was not initialized
+ReturnState GetTimingStatistics(const AdcHardwareNumber adc_number, TimingStatistics *statistics);
+
+
+  //CPU cycles per second, i.e. rate of Timestamp
+unsigned long GetTimestampFrequency();
+
   
 }               //namespace stm32adc
 
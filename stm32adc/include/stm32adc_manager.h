@@ -8,25 +8,143 @@
 
 namespace stm32adc{
 
+constexpr int kBufferHalvesAmount = 2;
+constexpr int kChannelsAmount = kNoChannel;
+
+typedef enum {  kFirstHalf, 
+                kSecondHalf   }         BufferHalf;
+
+  //conversion timing of ADC: clock prescaler and sampling time of each channel
+struct AdcTiming {
+  AdcPrescaler prescaler;
+  SampleTime sample_time[kChannelsAmount];
+};
+
+typedef enum {  kInsideThresholds,
+                kBelowThresholds,
+                kAboveThresholds  }     ThresholdZone;
+
+  //thresholds of software engine or of hardware watchdog, no handler means not set
+struct ThresholdWatch {
+  AdcSample low;
+  AdcSample high;
+  ThresholdHandler handler;
+  void* context;
+  ThresholdZone zone;
+};
+
+struct SamplesSubscription {
+  AdcChannel channel;
+  SamplesHandler handler;
+  void* context;
+};
+
 class AdcManager{
 private:
   
   AdcHardwareNumber adc_number_;
+  DualMode dual_mode_;
+  
+  int allocated_channels_;
+  int block_length_;
+  SampleRate sample_rate_;
+  AdcSample* buffer_;
   
-  int allocated_buffer_size_;
-  AdcValue* buffer_;
+    //scan sequence: channel of each sample in order it is written to buffer, and slot (position of its sample) of each channel
+    //In dual modes samples of master and slave alternate, unused slave sample is kNoChannel
+    //This is the sequence being converted now, it is changed only at buffer wrap (see SwitchToRequestedScanList())
+  AdcChannel scan_order_[kChannelsAmount];
+  int sequence_samples_;
+  int channel_slot_[kChannelsAmount];
   
-  std::list< AdcChannel > channels_;
+    //scan list, requested by Add/Remove and waiting to be applied at buffer wrap
+  AdcChannel requested_order_[kChannelsAmount];
+  int requested_channels_;
+  bool channel_requested_[kChannelsAmount];
+    //timing, requested together with scan list and applied with it
+  AdcTiming timing_;
+  bool reconfiguration_pending_;
+  
+    //values of the last sequence converted with previous scan list,
+    //reported until the first sequence with new scan list is completed
+  AdcValue pass_end_value_[kChannelsAmount];
+  bool pass_end_value_ready_[kChannelsAmount];
+  bool scan_list_changed_;
+  
+    //oversampling state, indexed by channel
+  OversamplingOrder oversampling_order_[kChannelsAmount];
+  unsigned long oversampling_sum_[kChannelsAmount];
+  int oversampling_counter_[kChannelsAmount];
+  AdcValue oversampled_value_[kChannelsAmount];
+  bool oversampled_value_ready_[kChannelsAmount];
+  
+    //VDDA estimate: exponentially filtered VREFINT level with kSupplyFilterFraction fractional bits,
+    //and values derived from it, refreshed by block interrupt
+  unsigned long reference_filter_;
+  volatile SupplyVoltage supply_voltage_;
+  volatile SupplyCorrection supply_correction_;
+  volatile bool supply_ready_;
+  int reference_period_blocks_;
+  int reference_block_counter_;
+  bool reference_pending_;
+  
+    //scheduled calibration: block counter and flag of calibration, postponed till the gap before next trigger
+  int recalibration_period_blocks_;
+  int recalibration_block_counter_;
+  bool recalibration_due_;
+  CalibrationStatistics calibration_statistics_;
+  
+    //software threshold engine, indexed by channel
+  ThresholdWatch thresholds_[kChannelsAmount];
+    //hardware watchdog: its channel (kNoChannel for all), and whether its interrupt is enabled
+  ThresholdWatch watchdog_;
+  AdcChannel watchdog_channel_;
+  bool watchdog_armed_;
+  
+    //block timestamps: high part of extended cycle counter, time of the last block and its period (CPU cycles)
+    //timing statistics are kept in cycles as well, and converted on request
+  Timestamp cycle_count_high_;
+  unsigned long last_cycle_count_;
+  Timestamp nominal_block_period_;
+  Timestamp block_time_;
+  Timestamp block_period_;
+  bool block_time_valid_;
+  unsigned long timed_blocks_;
+  unsigned long timing_gaps_;
+  Timestamp min_block_period_;
+  Timestamp max_block_period_;
+  unsigned long last_latency_;
+  unsigned long max_latency_;
+  
+  std::list< SamplesSubscription > subscriptions_;
   
   bool initialised_;
   
   AdcManager() = delete;
   AdcManager(const AdcManager&) = delete;
   
-  bool HaveChannelInScanList(const AdcChannel channel);
-  int GetChannelIndex(const AdcChannel channel);
+  bool HaveChannelInScanList(const AdcChannel channel) const;
+  int GetChannelIndex(const AdcChannel channel) const;
+  int GetLastCompletedSequence();
   
-  void InvalidateBufferValues();
+  int GetSequenceSamples(const int channels_amount) const;
+  int BuildScanSequence(AdcChannel* sequence) const;
+  SampleRate PlanSampleRate(const AdcTiming &timing, const AdcChannel* added_channels, const int added_amount, const int added_default_channels) const;
+  ReturnState UpdateScanList();
+  bool SwitchToRequestedScanList(AdcChannel* sequence, int* samples_amount);
+  void CompleteScanListSwitch(const AdcChannel* sequence, const int samples_amount);
+  void ActivateScanSequence(const AdcChannel* sequence, const int samples_amount);
+  ChannelSamples GetBlockSamples(const AdcSample* half_start, const int slot) const;
+  void ResetOversampling(const AdcChannel channel);
+  void AccumulateOversampling(const AdcChannel channel, const ChannelSamples &samples);
+  void UpdateSupplyEstimate();
+  void RestartBlockTiming();
+  void UpdateBlockTime();
+  ReturnState Calibrate();
+  void UpdateCalibration();
+  void CheckThresholds(const AdcChannel channel, const ChannelSamples &samples);
+  void RearmWatchdog(const AdcSample* half_start);
+  void FilterReference(const AdcSample reference);
 public:
   
   AdcManager( const AdcHardwareNumber adc_number, const AdcConfiguration &configuration );
@@ -38,7 +156,51 @@ public:
   
   ReturnState GetChannelValue( const AdcChannel channel, AdcValue* value );
   
+  ReturnState ConvertChannelsOnce( const AdcChannel* channels, const int channels_amount, AdcValue* values );
+  
+  ReturnState SetChannelOversampling( const AdcChannel channel, const OversamplingOrder order );
+  
+  ReturnState SetChannelSampleTime( const AdcChannel channel, const SampleTime sample_time );
+  
+  ReturnState SetAdcPrescaler( const AdcPrescaler prescaler );
+  
   ReturnState RemoveChannelFromScanList( const AdcChannel channel_to_remove );
+  
+  ReturnState Subscribe( const AdcChannel channel, const SamplesHandler handler, void* context );
+  
+  ReturnState Unsubscribe( const AdcChannel channel, void* context );
+  
+  SampleRate GetSampleRate() const;
+  
+  SampleRate GetAchievableSampleRate() const;
+  
+  DualMode GetDualMode() const;
+  
+  int GetChannelsCapacity() const;
+  
+  ReturnState GetSupplyVoltage( SupplyVoltage* vdda ) const;
+  
+  ReturnState GetSupplyCorrection( SupplyCorrection* correction ) const;
+  
+  void GetCalibrationStatistics( CalibrationStatistics* statistics );
+  
+  void GetTimingStatistics( TimingStatistics* statistics );
+  
+  ReturnState SetAnalogWatchdog( const AdcChannel channel, const AdcSample low_threshold, const AdcSample high_threshold,
+                                 const ThresholdHandler handler, void* context );
+  
+  ReturnState ClearAnalogWatchdog();
+  
+  ReturnState SetChannelThresholds( const AdcChannel channel, const AdcSample low_threshold, const AdcSample high_threshold,
+                                    const ThresholdHandler handler, void* context );
+  
+  ReturnState ClearChannelThresholds( const AdcChannel channel );
+  
+  //called from interrupt
+  void ReportWatchdogEvent( const AdcChannel channel, const AdcSample sample );
+  
+  //called from interrupt
+  void DeliverBlock( const BufferHalf completed_half );
 };
 
 }               //namespace stm32adc
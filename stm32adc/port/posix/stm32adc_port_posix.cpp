@@ -0,0 +1,474 @@
+//file stm32adc_port_posix.cpp
+//port for host simulation (Linux, FreeRTOS POSIX port)
+//Replaces stm32adc_port.cpp in host build. DMA buffer is filled by synthetic signal generators,
+//block interrupts are raised from portServiceSimulation(), which application calls
+//from interrupt-like context (FreeRTOS tick hook)
+
+#include <set>
+#include <cmath>
+#include <ctime>
+
+#include "stm32adcConfig.h"
+#include "stm32adc.h"
+#include "stm32adc_manager.h"
+
+namespace stm32adc {
+
+extern void HandleBlockComplete(const AdcHardwareNumber adc_number, const BufferHalf completed_half);
+extern void HandleWatchdogEvent(const AdcHardwareNumber adc_number, const AdcChannel channel, const AdcSample sample);
+
+typedef enum {kSignalDc, kSignalSine, kSignalNoise}     SignalShape;
+
+struct SignalGenerator {
+  SignalShape   shape;
+  float         offset;         //adc levels
+  float         amplitude;      //adc levels, peak for sine, peak-to-peak for noise
+  float         frequency;      //Hz, used by sine only
+};
+
+  //what is "connected" to each input, edit to model other signals
+static const SignalGenerator kChannelSignals[] = {
+  /* ch0 */ {kSignalDc,    2048.0f,    0.0f,    0.0f},
+  /* ch1 */ {kSignalSine,  2048.0f, 1500.0f,   50.0f},
+  /* ch2 */ {kSignalSine,  2048.0f, 1000.0f,   60.0f},
+  /* ch3 */ {kSignalSine,  2048.0f, 1800.0f,   40.0f},
+  /* ch4 */ {kSignalSine,  2048.0f,  700.0f,   70.0f},
+  /* ch5 */ {kSignalNoise, 2048.0f,  400.0f,    0.0f},
+  /* ch6 */ {kSignalDc,    1024.0f,    0.0f,    0.0f},
+  /* ch7 */ {kSignalSine,  1024.0f,  500.0f,   55.0f},
+  /* ch8 */ {kSignalNoise, 3000.0f,   50.0f,    0.0f},
+  /* ch9 */ {kSignalDc,       0.0f,    0.0f,    0.0f}
+};
+
+  //internal channels: temperature sensor (1.43V at 25C) and VREFINT, converted with simulated supply voltage,
+  //which is a bit below nominal, as on loaded board
+static const float kSimulatedVdda = 3.25f;
+static const float kTemperatureSensorVoltage = 1.43f;
+static const float kVrefintVoltage = adc_configVREFINT_MILLIVOLTS / 1000.0f;
+
+static const std::set<AdcChannel> port_available_channels = { kCh0, kCh1, kCh2, kCh3, kCh4, kCh5, kCh6, kCh7, kCh8, kCh9 };
+
+extern const int port_kAvailableAdcChannelsAmount = 16;
+
+  //same conversion timing as on target, so that capacity planning is identical
+static const unsigned long kAdcMaxClock = 14000000UL;
+static const unsigned long kPrescalerDivider[] = {2, 4, 6, 8};
+static const unsigned long kSampleHalfCycles[] = {3, 15, 27, 57, 83, 111, 143, 479};
+static const unsigned long kConversionHalfCycles = 25;
+
+  //generation does not try to catch up for more than this, e.g. after debugger stop
+static const long kMaxCatchUpSequences = 1000;
+
+static const double kPi = 3.14159265358979323846;
+
+  //state of simulated ADC together with its DMA channel
+  //In dual mode ADC1 simulates the pair: -sequence- holds samples of master and slave in turn
+struct SimulatedAdc {
+  AdcSample*    buffer;
+  SampleRate    sample_rate;            //scan sequences per second
+  DualMode      dual_mode;
+  AdcChannel    sequence[kNoChannel];
+  int           sequence_length;
+  int           total_transfers;
+  int           dma_index;
+  bool          running;
+  bool          masked;
+  timespec      start_time;
+  long long     generated_sequences;
+  AdcSample     injected_results[kMaxInjectedChannels];
+  bool          injected_ready;
+  bool          watchdog_enabled;
+  bool          watchdog_armed;         //watchdog interrupt enabled
+  AdcChannel    watchdog_channel;       //kNoChannel for all
+  AdcSample     watchdog_low;
+  AdcSample     watchdog_high;
+};
+
+static SimulatedAdc simulated_adc[kAdc3 + 1] = {};
+
+static unsigned long noise_state = 0x2545F491UL;
+
+static float NextNoise(){
+  //xorshift32, uniform in [-0.5; 0.5]
+  noise_state ^= noise_state << 13;
+  noise_state ^= noise_state >> 17;
+  noise_state ^= noise_state << 5;
+  noise_state &= 0xFFFFFFFFUL;
+  return static_cast<float>(noise_state) / 4294967296.0f - 0.5f;
+}
+
+static AdcSample GenerateSample(const AdcChannel channel, const double time){
+  if(channel == kNoChannel)
+    return 0;                   //slave sample of unpaired channel
+
+  if( (channel == kCh16) || (channel == kCh17) ){
+    const float voltage = (channel == kCh16) ? kTemperatureSensorVoltage : kVrefintVoltage;
+    return static_cast<AdcSample>( voltage / kSimulatedVdda * kMaxAdcValue + 2.0f * NextNoise() + 0.5f );
+  }
+
+  const SignalGenerator &signal = kChannelSignals[channel];
+  float level = signal.offset;
+
+  switch(signal.shape){
+  case kSignalSine:
+    level += signal.amplitude * static_cast<float>( std::sin(2.0 * kPi * signal.frequency * time) );
+    break;
+  case kSignalNoise:
+    level += signal.amplitude * NextNoise();
+    break;
+  case kSignalDc:
+  default:
+    break;
+  }
+
+  if(level < 0.0f)
+    return 0;
+  if(level > kMaxAdcValue)
+    return kMaxAdcValue;
+  return static_cast<AdcSample>(level + 0.5f);
+}
+
+static long long ElapsedNanoseconds(const timespec &since){
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since.tv_sec) * 1000000000LL + (now.tv_nsec - since.tv_nsec);
+}
+
+static SimulatedAdc* GetSimulatedAdc(const AdcHardwareNumber adc_number){
+  if( (adc_number < kAdc1) || (adc_number > kAdc3) )
+    return nullptr;
+  return &simulated_adc[adc_number];
+}
+
+
+ReturnState portChannelAvailable(const AdcChannel channel_to_add){
+  if(port_available_channels.find(channel_to_add) == port_available_channels.end())
+    return kError;
+  return kOk;
+}
+
+
+  //as on target, ADC2 is available only as slave of ADC1
+ReturnState portInitAdc(const AdcHardwareNumber adc_number, AdcSample* buffer_address, const SampleRate sample_rate, const DualMode dual_mode){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+
+  if( (adc == nullptr) || (buffer_address == nullptr) || (sample_rate <= 0) )
+    return kError;
+
+  if( (adc_number == kAdc2) || ((dual_mode != kIndependentMode) && (adc_number != kAdc1)) )
+    return kError;
+
+  *adc = {};
+  adc->buffer = buffer_address;
+  adc->dual_mode = dual_mode;
+  //in fast interleaved mode each sequence holds two samples of the channel
+  adc->sample_rate = (dual_mode == kFastInterleavedMode) ? sample_rate / 2 : sample_rate;
+  return kOk;
+}
+
+
+static ReturnState CheckSequence(const SimulatedAdc &adc, const AdcChannel* sequence, const int samples_amount){
+  for(int i = 0; i < samples_amount; i++){
+    const bool slave_sample = (adc.dual_mode != kIndependentMode) && (i % 2 == 1);
+    if( slave_sample && (sequence[i] == kNoChannel) )
+      continue;
+    if(portChannelAvailable(sequence[i]) != kOk)
+      return kError;
+  }
+  return kOk;
+}
+
+
+ReturnState portPerformScanning(const AdcHardwareNumber adc_number, const AdcChannel* sequence, const int samples_amount, const int sequences_amount, const AdcTiming &){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+
+  if( (adc == nullptr) || (adc->buffer == nullptr) )
+    return kAdcNotInitialised;
+
+  if(CheckSequence(*adc, sequence, samples_amount) != kOk)
+    return kError;
+
+  adc->running = false;
+  adc->sequence_length = samples_amount;
+  for(int i = 0; i < samples_amount; i++)
+    adc->sequence[i] = sequence[i];
+
+  adc->total_transfers = adc->sequence_length * sequences_amount;
+  adc->dma_index = 0;
+  adc->generated_sequences = 0;
+  clock_gettime(CLOCK_MONOTONIC, &adc->start_time);
+  adc->running = (adc->total_transfers > 0);
+  return kOk;
+}
+
+
+  //called from HandleBlockComplete() right after wrap, next sequence is generated with new list
+  //timing does not affect generated signals
+ReturnState portApplyChannelsSequence(const AdcHardwareNumber adc_number, const AdcChannel* sequence, const int samples_amount, const int sequences_amount, const AdcTiming &){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+  
+  if( (adc == nullptr) || (!adc->running) || (adc->dma_index != 0) )
+    return kError;
+  
+  if( (samples_amount <= 0) || (CheckSequence(*adc, sequence, samples_amount) != kOk) )
+    return kError;
+  
+  adc->sequence_length = samples_amount;
+  for(int i = 0; i < samples_amount; i++)
+    adc->sequence[i] = sequence[i];
+  
+  adc->total_transfers = adc->sequence_length * sequences_amount;
+  return kOk;
+}
+
+
+SampleRate portMaxSampleRate(const AdcHardwareNumber, const AdcPrescaler prescaler, const SampleTime* sample_times, const int channels_amount){
+
+  if( (prescaler < kAdcPrescaler2) || (prescaler > kAdcPrescaler8) )
+    return 0;
+
+  const unsigned long adc_clock = adc_configADC_INPUT_CLOCK / kPrescalerDivider[prescaler];
+
+  if(adc_clock > kAdcMaxClock)
+    return 0;
+
+  unsigned long half_cycles = 0;
+
+  for(int i = 0; i < channels_amount; i++)
+    half_cycles += kSampleHalfCycles[sample_times[i]] + kConversionHalfCycles;
+
+  if(half_cycles == 0)
+    return 0;
+
+  return 2 * adc_clock / half_cycles;
+}
+
+
+  //as on target, ADC1 also converts internal channels as injected ones
+static ReturnState CheckInjectedChannels(const AdcHardwareNumber adc_number, const AdcChannel* channels, const int channels_amount){
+  if( (channels_amount <= 0) || (channels_amount > kMaxInjectedChannels) )
+    return kError;
+
+  for(int i = 0; i < channels_amount; i++){
+    const bool internal_channel = (adc_number == kAdc1) && ( (channels[i] == kCh16) || (channels[i] == kCh17) );
+    if( (!internal_channel) && (portChannelAvailable(channels[i]) != kOk) )
+      return kError;
+  }
+  return kOk;
+}
+
+
+  //injected conversion is taken at once, it does not disturb generated scan sequences
+ReturnState portStartInjected(const AdcHardwareNumber adc_number, const AdcChannel* channels, const SampleTime*, const int channels_amount){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+
+  if( (adc == nullptr) || (adc->buffer == nullptr) )
+    return kAdcNotInitialised;
+
+  if(CheckInjectedChannels(adc_number, channels, channels_amount) != kOk)
+    return kError;
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const double time = now.tv_sec + now.tv_nsec / 1000000000.0;
+
+  for(int i = 0; i < channels_amount; i++)
+    adc->injected_results[i] = GenerateSample(channels[i], time);
+
+  adc->injected_ready = true;
+  return kOk;
+}
+
+
+ReturnState portReadInjected(const AdcHardwareNumber adc_number, AdcSample* results, const int channels_amount){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+
+  if( (adc == nullptr) || (channels_amount <= 0) || (channels_amount > kMaxInjectedChannels) )
+    return kError;
+
+  if(!adc->injected_ready)
+    return kValueNotReady;
+
+  for(int i = 0; i < channels_amount; i++)
+    results[i] = adc->injected_results[i];
+
+  adc->injected_ready = false;
+  return kOk;
+}
+
+
+ReturnState portConvertInjected(const AdcHardwareNumber adc_number, const AdcChannel* channels, const SampleTime* sample_times, const int channels_amount, AdcSample* results){
+  const ReturnState start_status = portStartInjected(adc_number, channels, sample_times, channels_amount);
+
+  if(start_status != kOk)
+    return start_status;
+
+  return portReadInjected(adc_number, results, channels_amount);
+}
+
+
+  //watchdog is checked as each sample is generated, the event is raised at once, before block events
+ReturnState portSetAnalogWatchdog(const AdcHardwareNumber adc_number, const AdcChannel channel, const AdcSample low_threshold, const AdcSample high_threshold){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+
+  if( (adc == nullptr) || (adc->buffer == nullptr) )
+    return kAdcNotInitialised;
+
+  if(adc_number != kAdc1)
+    return kError;
+
+  adc->watchdog_channel = channel;
+  adc->watchdog_low = low_threshold;
+  adc->watchdog_high = high_threshold;
+  adc->watchdog_enabled = true;
+  adc->watchdog_armed = true;
+  return kOk;
+}
+
+
+void portArmAnalogWatchdog(const AdcHardwareNumber adc_number){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+  if( (adc != nullptr) && adc->watchdog_enabled )
+    adc->watchdog_armed = true;
+}
+
+
+void portClearAnalogWatchdog(const AdcHardwareNumber adc_number){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+  if(adc != nullptr){
+    adc->watchdog_enabled = false;
+    adc->watchdog_armed = false;
+  }
+}
+
+
+static void CheckWatchdog(SimulatedAdc &adc, const AdcHardwareNumber adc_number, const int sequence_index, const AdcSample sample){
+  if( (!adc.watchdog_enabled) || (!adc.watchdog_armed) )
+    return;
+
+  //in dual mode watchdog of master sees only its own samples
+  if( (adc.dual_mode != kIndependentMode) && (sequence_index % 2 == 1) )
+    return;
+
+  const AdcChannel channel = adc.sequence[sequence_index];
+  if( (adc.watchdog_channel != kNoChannel) && (channel != adc.watchdog_channel) )
+    return;
+
+  if( (sample >= adc.watchdog_low) && (sample <= adc.watchdog_high) )
+    return;
+
+  adc.watchdog_armed = false;
+  HandleWatchdogEvent(adc_number, channel, sample);
+}
+
+
+  //there is no calibration to simulate: it takes no time and finds no offset
+ReturnState portCalibrateAdc(const AdcHardwareNumber adc_number, unsigned long* duration_ns, unsigned long* calibration_code){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+
+  if( (adc == nullptr) || (adc->buffer == nullptr) )
+    return kAdcNotInitialised;
+
+  if( (adc->dual_mode == kFastInterleavedMode) && adc->running )
+    return kError;
+
+  *duration_ns = 0;
+  *calibration_code = 0;
+  return kOk;
+}
+
+
+  //monotonic clock plays cycle counter: one "cycle" per nanosecond, 32 bits wide, as DWT counter
+unsigned long portGetCycleFrequency(){
+  return 1000000000UL;
+}
+
+
+  //simulated triggers come exactly at sequence times, the last one is that of the last generated sequence
+void portReadTriggerTime(const AdcHardwareNumber adc_number, unsigned long* cycle_count, unsigned long* cycles_since_trigger){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+
+  *cycle_count = 0;
+  *cycles_since_trigger = 0;
+
+  if( (adc == nullptr) || (!adc->running) )
+    return;
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  *cycle_count = static_cast<unsigned long>( (now.tv_sec * 1000000000LL + now.tv_nsec) & 0xFFFFFFFFLL );
+
+  const long long elapsed_ns = (now.tv_sec - adc->start_time.tv_sec) * 1000000000LL + (now.tv_nsec - adc->start_time.tv_nsec);
+  const long long trigger_ns = (adc->generated_sequences - 1) * 1000000000LL / adc->sample_rate;
+  const long long since_trigger_ns = elapsed_ns - trigger_ns;
+  *cycles_since_trigger = (since_trigger_ns > 0) ? static_cast<unsigned long>(since_trigger_ns) : 0;
+}
+
+
+int portGetRemainingTransfers(const AdcHardwareNumber adc_number){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+
+  if( (adc == nullptr) || (!adc->running) )
+    return 0;
+
+  return adc->total_transfers - adc->dma_index;
+}
+
+
+void portMaskBlockInterrupt(const AdcHardwareNumber adc_number){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+  if(adc != nullptr)
+    adc->masked = true;
+}
+
+
+void portUnmaskBlockInterrupt(const AdcHardwareNumber adc_number){
+  SimulatedAdc* adc = GetSimulatedAdc(adc_number);
+  if(adc != nullptr)
+    adc->masked = false;
+}
+
+
+  //Writes sequences due by now to DMA buffer and raises half/complete transfer events.
+  //While block interrupt is masked, generation is postponed, as pending interrupt on target
+void portServiceSimulation(){
+
+  for(int adc_index = kAdc1; adc_index <= kAdc3; adc_index++){
+    SimulatedAdc &adc = simulated_adc[adc_index];
+
+    if( (!adc.running) || adc.masked )
+      continue;
+
+    long long due_sequences = ElapsedNanoseconds(adc.start_time) * adc.sample_rate / 1000000000LL - adc.generated_sequences;
+
+    if(due_sequences > kMaxCatchUpSequences){
+      adc.generated_sequences += due_sequences - kMaxCatchUpSequences;
+      due_sequences = kMaxCatchUpSequences;
+    }
+
+    for( ; due_sequences > 0; due_sequences--){
+      const double time = static_cast<double>(adc.generated_sequences) / adc.sample_rate;
+
+      //interleaved samples are evenly spread over sequence period, others are taken at its start
+      const double sample_shift = (adc.dual_mode == kFastInterleavedMode) ? 1.0 / (adc.sequence_length * adc.sample_rate) : 0.0;
+
+      for(int i = 0; i < adc.sequence_length; i++){
+        const AdcSample sample = GenerateSample(adc.sequence[i], time + i * sample_shift);
+        adc.buffer[adc.dma_index++] = sample;
+        CheckWatchdog(adc, static_cast<AdcHardwareNumber>(adc_index), i, sample);
+      }
+
+      adc.generated_sequences++;
+
+      if(adc.dma_index == adc.total_transfers / kBufferHalvesAmount)
+        HandleBlockComplete( static_cast<AdcHardwareNumber>(adc_index), kFirstHalf );
+
+      if(adc.dma_index == adc.total_transfers){
+        adc.dma_index = 0;
+        HandleBlockComplete( static_cast<AdcHardwareNumber>(adc_index), kSecondHalf );
+      }
+    }
+  }
+}
+
+}               //namespace stm32adc
@@ -1,22 +1,48 @@
 //file stm32adc_port.cpp
 //port for stm32f103c8 (BluePill)
 
-#include <list>
 #include <set>
 
 #include "stm32f1xx.h"
 
 #include "stm32adcConfig.h"
 #include "stm32adc.h"
+#include "stm32adc_manager.h"
 
 namespace stm32adc {
   
+extern void HandleBlockComplete(const AdcHardwareNumber adc_number, const BufferHalf completed_half);
+extern void HandleWatchdogEvent(const AdcHardwareNumber adc_number, const AdcChannel channel, const AdcSample sample);
+  
 static const std::set<AdcChannel> port_available_channels = { kCh0, kCh1, kCh2, kCh3, kCh4, kCh5, kCh6, kCh7, kCh8, kCh9 };
   
 extern const int port_kAvailableAdcChannelsAmount = 16;
   
 static std::set<AdcHardwareNumber> active_adc = {};
 
+  //dual mode of ADC1 (master) and ADC2 (slave). ADC2 has no DMA request, so it is used only as slave
+static DualMode port_dual_mode = kIndependentMode;
+
+  //slave sample of unpaired channel: ADC2 inputs 16 and 17 are internally connected to VSSA
+static const AdcChannel kSlaveFillerChannel = kCh17;
+
+  //ADC power-up time (1us) in busy loop iterations
+static const int kAdcStabilisationLoops = 100;
+
+  //calibration: reset of calibration registers and 83 ADC cycles of calibration itself, with some margin
+static const unsigned long kCalibrationAdcCycles = 100;
+static const int kCalibrationTimeoutLoops = 10000;
+
+  //injected sequence of the slowest channels (4 x 252 cycles at 9MHz) takes ~112us, poll JEOC not longer than ~10 times that
+static const int kInjectedTimeoutLoops = 100000;
+
+  //ADCCLK = adc_configADC_INPUT_CLOCK / divider, it must not exceed 14MHz
+static const unsigned long kAdcMaxClock = 14000000UL;
+static const unsigned long kPrescalerDivider[] = {2, 4, 6, 8};
+  //sampling time of each SampleTime and conversion time (12.5 cycles), doubled to stay in integers
+static const unsigned long kSampleHalfCycles[] = {3, 15, 27, 57, 83, 111, 143, 479};
+static const unsigned long kConversionHalfCycles = 25;
+
 static bool IsAdcActive(const AdcHardwareNumber adc_number){
   return active_adc.find(adc_number) != active_adc.end();
 }
@@ -25,6 +51,8 @@ static ADC_TypeDef* GetAdcBase(const AdcHardwareNumber adc_number){
   switch(adc_number){
   case kAdc1:
     return ADC1;
+  case kAdc2:
+    return ADC2;
   case kAdc3:
     return nullptr;
   default:
@@ -32,6 +60,14 @@ static ADC_TypeDef* GetAdcBase(const AdcHardwareNumber adc_number){
   }
 }
 
+  //slave of -adc_number- in dual mode, nullptr in independent mode
+static ADC_TypeDef* GetSlaveAdcBase(const AdcHardwareNumber adc_number){
+  if( (adc_number != kAdc1) || (port_dual_mode == kIndependentMode) )
+    return nullptr;
+  return ADC2;
+}
+
+  //ADC2 has no DMA channel, its results are read by DMA of ADC1 in dual mode
 static DMA_Channel_TypeDef* GetDmaChannelBase(const AdcHardwareNumber adc_number){
   switch(adc_number){
   case kAdc1:
@@ -43,11 +79,34 @@ static DMA_Channel_TypeDef* GetDmaChannelBase(const AdcHardwareNumber adc_number
   }  
 }
 
+static TIM_TypeDef* GetTriggerTimerBase(const AdcHardwareNumber adc_number){
+  switch(adc_number){
+  case kAdc1:
+    return TIM3;
+  case kAdc3:
+    return nullptr;
+  default:
+    return nullptr;
+  }  
+}
+
+static IRQn_Type GetDmaIrq(const AdcHardwareNumber adc_number){
+  switch(adc_number){
+  case kAdc1:
+    return DMA1_Channel1_IRQn;
+  default:
+    return DMA1_Channel1_IRQn;
+  }  
+}
+
 static ReturnState EnableAdcClock(const AdcHardwareNumber adc_number){
   switch(adc_number){
   case kAdc1:
     RCC->APB2ENR |= RCC_APB2ENR_ADC1EN;         //clock source ADC1
     return kOk;
+  case kAdc2:
+    RCC->APB2ENR |= RCC_APB2ENR_ADC2EN;         //clock source ADC2
+    return kOk;
   case kAdc3:
     return kError;
   default:
@@ -55,49 +114,203 @@ static ReturnState EnableAdcClock(const AdcHardwareNumber adc_number){
   }  
 }  
 
+
+static unsigned long GetAdcClock(const AdcPrescaler prescaler){
+  return adc_configADC_INPUT_CLOCK / kPrescalerDivider[prescaler];
+}
+
+static unsigned long GetChannelHalfCycles(const SampleTime sample_time){
+  return kSampleHalfCycles[sample_time] + kConversionHalfCycles;
+}
+  
+  //In dual mode odd samples of sequence are converted by slave: 
+  //it may have no channel, and it has no internal channels
+static ReturnState portCheckChannelsValidity(const AdcHardwareNumber adc_number, const AdcChannel* sequence, const int samples_amount){
+  const bool dual = (GetSlaveAdcBase(adc_number) != nullptr);
   
-static ReturnState portCheckChannelsValidity(const std::list<AdcChannel> &channels){
-  for(auto it : channels){
-    if(port_available_channels.find(it) == port_available_channels.end())
+  for(int i = 0; i < samples_amount; i++){
+    const bool slave_sample = dual && (i % 2 == 1);
+    
+    if( slave_sample && (sequence[i] == kNoChannel) )
+      continue;
+    if( slave_sample && (sequence[i] >= kCh16) )
+      return kError;
+    if(port_available_channels.find(sequence[i]) == port_available_channels.end())
       return kError;
   }
   return kOk;
 }
 
 
-static ReturnState portUpdateChannelsSequence(const AdcHardwareNumber adc_number, const std::list<AdcChannel> &channels_list){
+  //Trigger timer generates TRGO on each update event with frequency -sample_rate-
+static ReturnState portConfigureTriggerTimer(const AdcHardwareNumber adc_number, const SampleRate sample_rate){
+  
+  TIM_TypeDef* selected_timer = GetTriggerTimerBase(adc_number);
+  
+  if( (selected_timer == nullptr) || (sample_rate <= 0) )
+    return kError;
+  
+  const unsigned long timer_ticks = adc_configTRIGGER_TIMER_CLOCK / sample_rate;
+  
+  if(timer_ticks < 2)
+    return kError;
+  
+  const unsigned long prescaler = (timer_ticks - 1) / 0x10000;
+  const unsigned long reload = timer_ticks / (prescaler + 1) - 1;
+  
+  RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;         //clock source of trigger timer
+  
+  selected_timer->CR1 = 0;                    //stopped, counts up
+  selected_timer->PSC = prescaler;
+  selected_timer->ARR = reload;
+  selected_timer->CR2 = TIM_CR2_MMS_1;        //TRGO on update event
+  selected_timer->EGR = TIM_EGR_UG;           //load prescaler
+  selected_timer->SR = 0;
+  
+  return kOk;
+}
+
+
+  //SMPR1 holds channels 10..17, SMPR2 holds channels 0..9, 3 bits each
+static void portWriteSampleTime(ADC_TypeDef* selected_adc, const AdcChannel channel, const SampleTime sample_time){
+  if(channel < kCh10){
+    const int shift = channel * 3;
+    selected_adc->SMPR2 = (selected_adc->SMPR2 & ~(0x7UL << shift)) | (sample_time << shift);
+  }
+  else {
+    const int shift = (channel - kCh10) * 3;
+    selected_adc->SMPR1 = (selected_adc->SMPR1 & ~(0x7UL << shift)) | (sample_time << shift);
+  }
+}
+
+static SampleTime portReadSampleTime(const ADC_TypeDef* selected_adc, const AdcChannel channel){
+  if(channel < kCh10)
+    return static_cast<SampleTime>( (selected_adc->SMPR2 >> (channel * 3)) & 0x7UL );
+  return static_cast<SampleTime>( (selected_adc->SMPR1 >> ((channel - kCh10) * 3)) & 0x7UL );
+}
+
+  //channel at position -slot- of scan sequence, programmed into ADC
+static AdcChannel portReadSequenceChannel(const ADC_TypeDef* selected_adc, const int slot){
+  uint32_t channel_code;
+  if(slot < 6)
+    channel_code = selected_adc->SQR3 >> (slot * 5);
+  else if(slot < 12)
+    channel_code = selected_adc->SQR2 >> ((slot - 6) * 5);
+  else
+    channel_code = selected_adc->SQR1 >> ((slot - 12) * 5);
+  return static_cast<AdcChannel>( channel_code & 0x1FUL );
+}
+
+  //ADC clock is common for ADC1 and ADC2
+static void portWriteAdcPrescaler(const AdcPrescaler prescaler){
+  RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_ADCPRE) | (prescaler << RCC_CFGR_ADCPRE_Pos);
+}
+
+static AdcPrescaler portReadAdcPrescaler(){
+  return static_cast<AdcPrescaler>( (RCC->CFGR & RCC_CFGR_ADCPRE) >> RCC_CFGR_ADCPRE_Pos );
+}
+
+
+  //writes -length- channels, taken from -sequence- with step -step-, into regular sequence of -selected_adc-
+static void portWriteRegularSequence(ADC_TypeDef* selected_adc, const AdcChannel* sequence, const int step, const int length){
+  
+  selected_adc->SQR1 = 0;
+  selected_adc->SQR2 = 0;
+  selected_adc->SQR3 = 0;
+  
+  for(int ch_order = 0; ch_order < length; ch_order++){
+    const AdcChannel channel = (sequence[ch_order * step] == kNoChannel) ? kSlaveFillerChannel : sequence[ch_order * step];
+    if(ch_order < 6)
+      selected_adc->SQR3 |= (channel << (ch_order * 5));
+    else if (ch_order < 12)
+      selected_adc->SQR2 |= (channel << ((ch_order-6) * 5));
+    else if (ch_order < 16)
+      selected_adc->SQR1 |= (channel << ((ch_order-12) * 5));
+  }
+  
+  int sequence_length = length > 0 ? length - 1 : 0;
+  selected_adc->SQR1 |= (sequence_length << ADC_SQR1_L_Pos);
+}
+
+
+  //Channels of a pair are sampled with the same (longer) time, so that their conversions stay simultaneous
+  //Fast interleaved mode needs 7 cycles between master and slave, i.e. 14 cycles per conversion
+static SampleTime GetPairSampleTime(const AdcChannel master_channel, const AdcChannel slave_channel, const AdcTiming &timing){
+  if(port_dual_mode == kFastInterleavedMode)
+    return kSampleTime1_5;
+  
+  const SampleTime master_time = timing.sample_time[master_channel];
+  
+  if( (slave_channel == kNoChannel) || (timing.sample_time[slave_channel] <= master_time) )
+    return master_time;
+  
+  return timing.sample_time[slave_channel];
+}
+
+
+static ReturnState portUpdateChannelsSequence(const AdcHardwareNumber adc_number, const AdcChannel* sequence, const int samples_amount, const int sequences_amount, const AdcTiming &timing){
   
   if( !IsAdcActive(adc_number))
     return kAdcNotInitialised;
   
   ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  ADC_TypeDef* slave_adc = GetSlaveAdcBase(adc_number);
   DMA_Channel_TypeDef* selected_dma = GetDmaChannelBase(adc_number);
   
   if( (selected_adc == nullptr) || (selected_dma == nullptr) )
     return kError;
   
-  selected_adc->SQR1 = 0;
-  selected_adc->SQR2 = 0;
-  selected_adc->SQR3 = 0;
+  portWriteAdcPrescaler( timing.prescaler );
+  
+  if(slave_adc == nullptr){
+    portWriteRegularSequence( selected_adc, sequence, 1, samples_amount );
+    
+    for(int ch_order = 0; ch_order < samples_amount; ch_order++)
+      portWriteSampleTime( selected_adc, sequence[ch_order], timing.sample_time[sequence[ch_order]] );
+    
+    selected_dma->CNDTR = samples_amount * sequences_amount;
+    return kOk;
+  }
+  
+  //dual mode: master converts even samples, slave converts odd ones, each pair is one 32-bit transfer
+  const int pairs_amount = samples_amount / 2;
   
-  int ch_order = 0;
-  for(auto it = channels_list.begin(); it != channels_list.end(); it++){
-    if(ch_order < 8)
-      selected_adc->SQR3 |= (*it << (ch_order * 5));
-    else if (ch_order < 13)
-      selected_adc->SQR2 |= (*it << ((ch_order-8) * 5));
-    else if (ch_order < 17)
-      selected_adc->SQR1 |= (*it << ((ch_order-13) * 5));
-    ch_order++;
+  portWriteRegularSequence( selected_adc, sequence, 2, pairs_amount );
+  portWriteRegularSequence( slave_adc, sequence + 1, 2, pairs_amount );
+  
+  for(int pair = 0; pair < pairs_amount; pair++){
+    const AdcChannel master_channel = sequence[2 * pair];
+    const AdcChannel slave_channel = sequence[2 * pair + 1];
+    const SampleTime pair_time = GetPairSampleTime( master_channel, slave_channel, timing );
+    
+    portWriteSampleTime( selected_adc, master_channel, pair_time );
+    portWriteSampleTime( slave_adc, (slave_channel == kNoChannel) ? kSlaveFillerChannel : slave_channel, pair_time );
   }
   
-  int channels_amount = channels_list.size() > 0 ? channels_list.size() - 1 : 0;
-  selected_adc->SQR1 |= (channels_amount << ADC_SQR1_L_Pos);
-  selected_dma->CNDTR = channels_list.size();
+  selected_dma->CNDTR = pairs_amount * sequences_amount;
   return kOk;
 }
 
 
+  //amount of channels in scan sequence, currently programmed into ADC
+static int portGetSequenceLength(const ADC_TypeDef* selected_adc){
+  return ((selected_adc->SQR1 & ADC_SQR1_L) >> ADC_SQR1_L_Pos) + 1;
+}
+
+
+  //conversion time of scan sequence, currently programmed into ADC, in ticks of trigger timer clock
+static unsigned long portGetSequenceTimerTicks(const ADC_TypeDef* selected_adc){
+  unsigned long long half_cycles = 0;
+  
+  for(int slot = 0; slot < portGetSequenceLength(selected_adc); slot++)
+    half_cycles += GetChannelHalfCycles( portReadSampleTime( selected_adc, portReadSequenceChannel(selected_adc, slot) ) );
+  
+  const unsigned long long timer_ticks = half_cycles * kPrescalerDivider[portReadAdcPrescaler()] * adc_configTRIGGER_TIMER_CLOCK 
+                                          / adc_configADC_INPUT_CLOCK / 2;
+  return static_cast<unsigned long>(timer_ticks);
+}
+
+
 static ReturnState portSuspendAdcConversion(const AdcHardwareNumber adc_number){
   
   if( !IsAdcActive(adc_number))
@@ -105,14 +318,23 @@ static ReturnState portSuspendAdcConversion(const AdcHardwareNumber adc_number){
   
   ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
   DMA_Channel_TypeDef* selected_dma_channel = GetDmaChannelBase(adc_number);
+  TIM_TypeDef* selected_timer = GetTriggerTimerBase(adc_number);
   
-  if( (selected_adc == nullptr) || (selected_dma_channel == nullptr) )
+  if( (selected_adc == nullptr) || (selected_dma_channel == nullptr) || (selected_timer == nullptr) )
     return kError;
   
-  selected_adc->CR2 &= ~ADC_CR2_CONT;    //ifnish continious mode
+  selected_timer->CR1 &= ~TIM_CR1_CEN;   //no more triggers
   selected_adc->CR2 &= ~ADC_CR2_DMA;     //disable DMA request  
+  selected_adc->CR2 &= ~ADC_CR2_ADON;    //power down, it also resets scan sequence
+  
+  ADC_TypeDef* slave_adc = GetSlaveAdcBase(adc_number);
+  if(slave_adc != nullptr)
+    slave_adc->CR2 &= ~ADC_CR2_ADON;
   selected_dma_channel->CCR &= ~DMA_CCR_EN;    //Switch off adc1 channel DMA  
   
+  DMA1->IFCR = DMA_IFCR_CGIF1;           //drop flags of interrupted block
+  NVIC_ClearPendingIRQ( GetDmaIrq(adc_number) );
+  
   return kOk;
 }
 
@@ -122,17 +344,35 @@ static ReturnState portResumeAdcConversion(const AdcHardwareNumber adc_number){
   
   ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
   DMA_Channel_TypeDef* selected_dma_channel = GetDmaChannelBase(adc_number);
+  TIM_TypeDef* selected_timer = GetTriggerTimerBase(adc_number);
+  
+  if( (selected_adc == nullptr) || (selected_dma_channel == nullptr) || (selected_timer == nullptr) )
+    return kError;
   
   if( selected_dma_channel->CNDTR == 0 )
     return kOk;
   
-  if( (selected_adc == nullptr) || (selected_dma_channel == nullptr) )
-    return kError;
-  
   selected_dma_channel->CCR |= DMA_CCR_EN;    //Switch on adc1 channel DMA  
+  
+  ADC_TypeDef* slave_adc = GetSlaveAdcBase(adc_number);
+  if(slave_adc != nullptr)
+    slave_adc->CR2 |= ADC_CR2_ADON;
+  
+  selected_adc->CR2 |= ADC_CR2_ADON;    //power up; with external trigger it does not start conversion
+  
+  for(volatile int i = 0; i < kAdcStabilisationLoops; i++){
+    ;
+  }
+  
   selected_adc->CR2 |= ADC_CR2_DMA;     //enable DMA request  
-  selected_adc->CR2 |= ADC_CR2_CONT;    //start continious mode
-  selected_adc->CR2 |= ADC_CR2_ADON;    //start conversion;
+  
+  if(port_dual_mode == kFastInterleavedMode){
+    selected_adc->CR2 |= ADC_CR2_SWSTART;       //continuous conversions of both ADC, trigger timer is not used
+    return kOk;
+  }
+  
+  selected_timer->CNT = 0;
+  selected_timer->CR1 |= TIM_CR1_CEN;   //triggers start conversions of the whole scan list
   return kOk;
 }
 
@@ -169,7 +409,15 @@ ReturnState portChannelAvailable(const AdcChannel channel_to_add){
 }
 
 
-ReturnState portInitAdc(const AdcHardwareNumber adc_number, AdcValue* buffer_address){
+  //CPU cycle counter of DWT, used for block timestamps and to measure calibration time
+static void portEnableCycleCounter(){
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+
+  //ADC2 can not be initialised alone (it has no DMA request), only as slave of ADC1 in dual mode
+ReturnState portInitAdc(const AdcHardwareNumber adc_number, AdcSample* buffer_address, const SampleRate sample_rate, const DualMode dual_mode){
   
   ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
   DMA_Channel_TypeDef* selected_dma_channel = GetDmaChannelBase(adc_number);
@@ -177,8 +425,14 @@ ReturnState portInitAdc(const AdcHardwareNumber adc_number, AdcValue* buffer_add
   if( (selected_adc == nullptr) || (selected_dma_channel == nullptr) )
     return kError;
   
-  //prescaler ADC
-  RCC->CFGR |= RCC_CFGR_ADCPRE_DIV8;      
+  if( (dual_mode != kIndependentMode) && (adc_number != kAdc1) )
+    return kError;
+  
+  if(adc_number == kAdc1)
+    port_dual_mode = dual_mode;
+  
+  //the slowest ADC clock until timing is applied together with scan list
+  portWriteAdcPrescaler( kAdcPrescaler8 );
   
   //Enable clock source for selected adc
   if(EnableAdcClock(adc_number) != kOk)
@@ -188,15 +442,9 @@ ReturnState portInitAdc(const AdcHardwareNumber adc_number, AdcValue* buffer_add
   selected_adc->CR1 = 0;      
   selected_adc->CR2 = 0;
   
-  //setup adc cycle duration    (239.5)
-  selected_adc->SMPR2 |= ADC_SMPR2_SMP0 | ADC_SMPR2_SMP1 
-  | ADC_SMPR2_SMP2 | ADC_SMPR2_SMP3 | ADC_SMPR2_SMP4 
-  | ADC_SMPR2_SMP5 | ADC_SMPR2_SMP6 | ADC_SMPR2_SMP7
-  | ADC_SMPR2_SMP8 | ADC_SMPR2_SMP9;       
-  
-  selected_adc->SMPR1 |= ADC_SMPR1_SMP10 | ADC_SMPR1_SMP11 
-  | ADC_SMPR1_SMP12 | ADC_SMPR1_SMP13 | ADC_SMPR1_SMP14 
-  | ADC_SMPR1_SMP15 | ADC_SMPR1_SMP16 | ADC_SMPR1_SMP17;   
+  //sampling time of each channel is written together with scan sequence, see portUpdateChannelsSequence()
+  selected_adc->SMPR1 = 0;
+  selected_adc->SMPR2 = 0;
 
   //all zeros mean that one regular channel and ch0 is the first (and the only one)
   selected_adc->SQR1 = 0; // 1  
@@ -220,36 +468,86 @@ ReturnState portInitAdc(const AdcHardwareNumber adc_number, AdcValue* buffer_add
   selected_dma_channel->CNDTR = 0;                           //amount of data to be transferred
     
   selected_dma_channel->CCR = DMA_CCR_MINC                   //mem increment
-    | DMA_CCR_CIRC;                                           //circular mode 
+    | DMA_CCR_CIRC                                            //circular mode 
+    | DMA_CCR_HTIE                                            //interrupt on completed first half
+    | DMA_CCR_TCIE;                                           //interrupt on completed second half
   
-  selected_dma_channel->CCR |= (1 << DMA_CCR_MSIZE_Pos);       //Size of memory cell = 16bit
-  selected_dma_channel->CCR |= (1 << DMA_CCR_PSIZE_Pos);       //Size of periph cell = 16 bit
+  if(dual_mode == kIndependentMode){
+    selected_dma_channel->CCR |= (1 << DMA_CCR_MSIZE_Pos);       //Size of memory cell = 16bit
+    selected_dma_channel->CCR |= (1 << DMA_CCR_PSIZE_Pos);       //Size of periph cell = 16 bit
+  }
+  else {
+    //ADC1 DR holds result of ADC2 in its upper half: master sample, then slave sample in buffer
+    selected_dma_channel->CCR |= (2 << DMA_CCR_MSIZE_Pos);       //Size of memory cell = 32bit
+    selected_dma_channel->CCR |= (2 << DMA_CCR_PSIZE_Pos);       //Size of periph cell = 32 bit
+  }
     
   selected_dma_channel->CCR |= DMA_CCR_EN;                  //Enable DMA for ADC
+  
+  NVIC_SetPriority( GetDmaIrq(adc_number), adc_configIRQ_PRIORITY );
+  NVIC_EnableIRQ( GetDmaIrq(adc_number) );
   ///////
-          
+  
+  if(dual_mode != kIndependentMode){
+    ADC_TypeDef* slave_adc = GetSlaveAdcBase(adc_number);
+    
+    EnableAdcClock(kAdc2);
+    slave_adc->CR1 = ADC_CR1_SCAN;
+    slave_adc->CR2 = ADC_CR2_EXTSEL | ADC_CR2_EXTTRIG;          //slave is started by master, its own trigger is SWSTART
+    if(dual_mode == kFastInterleavedMode)
+      slave_adc->CR2 |= ADC_CR2_CONT;
+    slave_adc->SMPR1 = 0;
+    slave_adc->SMPR2 = 0;
+    slave_adc->CR2 |= ADC_CR2_ADON;
+  }
+  
   selected_adc->CR1 |= ADC_CR1_SCAN;
   
-  selected_adc->CR2 |= ADC_CR2_ADON; // prepare ADC (for starting need to be done one more time -- it will be done later)  
+  //injected sequence is started by software (JEXTSEL = 111: JSWSTART), see portStartInjected()
+  selected_adc->CR2 |= ADC_CR2_JEXTSEL | ADC_CR2_JEXTTRIG;
+  
+  //temperature sensor and VREFINT are connected to ADC1 channels 16, 17
+  if(adc_number == kAdc1)
+    selected_adc->CR2 |= ADC_CR2_TSVREFE;
+  
+  if(dual_mode == kFastInterleavedMode){
+    //the only channel is converted continuously, started by SWSTART (EXTSEL = 111)
+    selected_adc->CR1 |= (0x7UL << ADC_CR1_DUALMOD_Pos);
+    selected_adc->CR2 |= ADC_CR2_EXTSEL | ADC_CR2_EXTTRIG | ADC_CR2_CONT;
+  }
+  else {
+    if( portConfigureTriggerTimer( adc_number, sample_rate ) != kOk )
+      return kError;
+    
+    if(dual_mode == kRegularSimultaneousMode)
+      selected_adc->CR1 |= (0x6UL << ADC_CR1_DUALMOD_Pos);
+    
+    //whole scan list is converted on each TRGO event of trigger timer (EXTSEL = 100: TIM3 TRGO)
+    selected_adc->CR2 |= ADC_CR2_EXTSEL_2 | ADC_CR2_EXTTRIG;
+  }
+  
+  selected_adc->CR2 |= ADC_CR2_ADON; // power up ADC, conversions are started by trigger timer
+  
+  portEnableCycleCounter();
   
   active_adc.insert(adc_number);        //add to active adc set
   
   return kOk;
 }
 
-ReturnState portPerformScanning(const AdcHardwareNumber adc_number, const std::list<AdcChannel> &channels){
+ReturnState portPerformScanning(const AdcHardwareNumber adc_number, const AdcChannel* sequence, const int samples_amount, const int sequences_amount, const AdcTiming &timing){
   
-  if( portCheckChannelsValidity( channels ) != kOk )
+  if( portCheckChannelsValidity( adc_number, sequence, samples_amount ) != kOk )
     return kError;
    
   if( portSuspendAdcConversion( adc_number ) != kOk )
     return kError;
  
-  if(portUpdateChannelsSequence( adc_number, channels ) != kOk)
+  if(portUpdateChannelsSequence( adc_number, sequence, samples_amount, sequences_amount, timing ) != kOk)
     return kError;
   
-  for(auto it = channels.begin(); it != channels.end(); it++)
-    portPrepareChannelGpioPin( *it );
+  for(int i = 0; i < samples_amount; i++)
+    portPrepareChannelGpioPin( sequence[i] );
 
   if( portResumeAdcConversion( adc_number ) != kOk )
     return kError;
@@ -257,4 +555,437 @@ ReturnState portPerformScanning(const AdcHardwareNumber adc_number, const std::l
   return kOk;  
 }
 
-}               //namespace stm32adc
\ No newline at end of file
+
+
+  //Switches scan sequence between two triggers without stopping ADC, so that timing of samples is kept
+  //Called from block interrupt right after DMA wrap. Trigger timer is held for a few microseconds meanwhile
+  //Returns kError and changes nothing, if conversion of the next sequence has already been started
+  //Not used in fast interleaved mode: its scan list is a single channel, it is never switched while running
+ReturnState portApplyChannelsSequence(const AdcHardwareNumber adc_number, const AdcChannel* sequence, const int samples_amount, const int sequences_amount, const AdcTiming &timing){
+  
+  if( !IsAdcActive(adc_number))
+    return kAdcNotInitialised;
+  
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  DMA_Channel_TypeDef* selected_dma_channel = GetDmaChannelBase(adc_number);
+  TIM_TypeDef* selected_timer = GetTriggerTimerBase(adc_number);
+  
+  if( (selected_adc == nullptr) || (selected_dma_channel == nullptr) || (selected_timer == nullptr) )
+    return kError;
+  
+  if( (samples_amount <= 0) || (port_dual_mode == kFastInterleavedMode) )
+    return kError;
+  
+  if( portCheckChannelsValidity( adc_number, sequence, samples_amount ) != kOk )
+    return kError;
+  
+  //one transfer per master conversion, also in dual mode
+  const int running_length = portGetSequenceLength(selected_adc);
+  
+  selected_timer->CR1 &= ~TIM_CR1_CEN;   //hold next trigger, counter keeps its phase
+  
+  //idle: nothing of new pass is transferred, and the sequence started by the last trigger is over
+  const unsigned long ticks_since_trigger = selected_timer->CNT * (selected_timer->PSC + 1);
+  const bool adc_idle = (selected_dma_channel->CNDTR == static_cast<uint32_t>(running_length * sequences_amount))
+                        && (ticks_since_trigger >= portGetSequenceTimerTicks(selected_adc));
+  
+  if(!adc_idle){
+    selected_timer->CR1 |= TIM_CR1_CEN;
+    return kError;
+  }
+  
+  for(int i = 0; i < samples_amount; i++)
+    portPrepareChannelGpioPin( sequence[i] );
+  
+  selected_dma_channel->CCR &= ~DMA_CCR_EN;    //CNDTR is writable only while channel is disabled
+  portUpdateChannelsSequence( adc_number, sequence, samples_amount, sequences_amount, timing );
+  selected_dma_channel->CCR |= DMA_CCR_EN;
+  
+  selected_timer->CR1 |= TIM_CR1_CEN;
+  return kOk;
+}
+
+
+  //highest trigger rate, at which sequence of channels with -sample_times- is converted within one period
+  //0, if -prescaler- would overclock ADC
+SampleRate portMaxSampleRate(const AdcHardwareNumber adc_number, const AdcPrescaler prescaler, const SampleTime* sample_times, const int channels_amount){
+  
+  if( (prescaler < kAdcPrescaler2) || (prescaler > kAdcPrescaler8) || (GetAdcClock(prescaler) > kAdcMaxClock) )
+    return 0;
+  
+  unsigned long half_cycles = 0;
+  
+  for(int i = 0; i < channels_amount; i++)
+    half_cycles += GetChannelHalfCycles( sample_times[i] );
+  
+  if(half_cycles == 0)
+    return 0;
+  
+  return 2 * GetAdcClock(prescaler) / half_cycles;
+}
+
+
+  //injected channels: available inputs and, on ADC1, internal channels (16: temperature sensor, 17: VREFINT)
+static ReturnState portCheckInjectedChannels(const AdcHardwareNumber adc_number, const AdcChannel* channels, const int channels_amount){
+  
+  if( (channels_amount <= 0) || (channels_amount > kMaxInjectedChannels) )
+    return kError;
+  
+  for(int i = 0; i < channels_amount; i++){
+    const bool internal_channel = (adc_number == kAdc1) && ( (channels[i] == kCh16) || (channels[i] == kCh17) );
+    if( (!internal_channel) && (portChannelAvailable(channels[i]) != kOk) )
+      return kError;
+  }
+  return kOk;
+}
+
+
+  //Starts conversion of -channels- as injected sequence (JSWSTART), does not wait for it. Running regular sequence
+  //is interrupted by it and then continues, DMA is not involved. Previous injected conversion must be over
+  //Called with block interrupt masked or from it: sampling time registers are shared with scan sequence
+ReturnState portStartInjected(const AdcHardwareNumber adc_number, const AdcChannel* channels, const SampleTime* sample_times, const int channels_amount){
+  
+  if( !IsAdcActive(adc_number))
+    return kAdcNotInitialised;
+  
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  
+  if( (selected_adc == nullptr) || (portCheckInjectedChannels( adc_number, channels, channels_amount ) != kOk) )
+    return kError;
+  
+  if( !(selected_adc->CR2 & ADC_CR2_ADON) )
+    return kError;
+  
+  //sequence shorter than 4 is taken from the last JSQ fields: JSQ(4 - amount + 1) .. JSQ4
+  const int first_position = kMaxInjectedChannels - channels_amount;
+  uint32_t injected_sequence = (channels_amount - 1) << ADC_JSQR_JL_Pos;
+  
+  for(int i = 0; i < channels_amount; i++){
+    injected_sequence |= channels[i] << ((first_position + i) * 5);
+    portWriteSampleTime( selected_adc, channels[i], sample_times[i] );
+    if(channels[i] < kCh16)
+      portPrepareChannelGpioPin( channels[i] );
+  }
+  
+  selected_adc->JSQR = injected_sequence;
+  
+  selected_adc->SR &= ~(ADC_SR_JEOC | ADC_SR_JSTRT);
+  selected_adc->CR2 |= ADC_CR2_JSWSTART;
+  return kOk;
+}
+
+
+  //Reads results of injected sequence, started by portStartInjected(), in order of conversion (from JDR1)
+  //Returns kValueNotReady, while the sequence is not yet converted
+ReturnState portReadInjected(const AdcHardwareNumber adc_number, AdcSample* results, const int channels_amount){
+  
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  
+  if( (selected_adc == nullptr) || (channels_amount <= 0) || (channels_amount > kMaxInjectedChannels) )
+    return kError;
+  
+  if( !(selected_adc->SR & ADC_SR_JEOC) )
+    return kValueNotReady;
+  
+  volatile uint32_t* injected_data = &(selected_adc->JDR1);
+  for(int i = 0; i < channels_amount; i++)
+    results[i] = static_cast<AdcSample>( injected_data[i] & 0xFFFFUL );
+  
+  selected_adc->SR &= ~(ADC_SR_JEOC | ADC_SR_JSTRT);
+  return kOk;
+}
+
+
+  //Converts -channels- once as injected sequence and waits for results. Injected conversion started
+  //before (e.g. in background by block interrupt) is waited for, its results are dropped.
+  //Powered down ADC (empty scan list) is powered up for that
+  //Called with block interrupt masked
+ReturnState portConvertInjected(const AdcHardwareNumber adc_number, const AdcChannel* channels, const SampleTime* sample_times, const int channels_amount, AdcSample* results){
+  
+  if( !IsAdcActive(adc_number))
+    return kAdcNotInitialised;
+  
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  
+  if( (selected_adc == nullptr) || (portCheckInjectedChannels( adc_number, channels, channels_amount ) != kOk) )
+    return kError;
+  
+  int loops = 0;
+  while( (selected_adc->SR & ADC_SR_JSTRT) && !(selected_adc->SR & ADC_SR_JEOC) && (loops < kInjectedTimeoutLoops) )
+    loops++;
+  
+  const bool powered_down = !(selected_adc->CR2 & ADC_CR2_ADON);
+  
+  if(powered_down){
+    selected_adc->CR2 |= ADC_CR2_ADON;    //with external triggers it does not start conversion
+    for(volatile int i = 0; i < kAdcStabilisationLoops; i++){
+      ;
+    }
+  }
+  
+  ReturnState result = portStartInjected( adc_number, channels, sample_times, channels_amount );
+  
+  loops = 0;
+  while( (result == kOk) && !(selected_adc->SR & ADC_SR_JEOC) && (loops < kInjectedTimeoutLoops) )
+    loops++;
+  
+  if(result == kOk)
+    result = portReadInjected( adc_number, results, channels_amount );
+  
+  if(powered_down)
+    selected_adc->CR2 &= ~ADC_CR2_ADON;
+  
+  return (result == kOk) ? kOk : kError;
+}
+
+
+  //RSTCAL, then CAL on master and slave in parallel, returns false on timeout
+static bool portRunCalibration(ADC_TypeDef* selected_adc, ADC_TypeDef* slave_adc){
+  const uint32_t steps[] = {ADC_CR2_RSTCAL, ADC_CR2_CAL};
+  
+  for(auto step : steps){
+    selected_adc->CR2 |= step;
+    if(slave_adc != nullptr)
+      slave_adc->CR2 |= step;
+    
+    int loops = 0;
+    while( ((selected_adc->CR2 & step) || ((slave_adc != nullptr) && (slave_adc->CR2 & step))) && (loops < kCalibrationTimeoutLoops) )
+      loops++;
+    
+    if(loops == kCalibrationTimeoutLoops)
+      return false;
+  }
+  return true;
+}
+
+
+  //Calibrates ADC (and slave in dual mode). Calibration needs ADC, which is not converting.
+  //While scan list runs, trigger timer is held, and calibration is done only if the last sequence is over and the gap 
+  //till next trigger is long enough; otherwise returns kValueNotReady. Then counter is moved forward by the time 
+  //it was held, so that the phase of triggers is kept and no sample is lost or delayed
+  //Called from block interrupt or before scanning is started. Not possible in running fast interleaved mode
+ReturnState portCalibrateAdc(const AdcHardwareNumber adc_number, unsigned long* duration_ns, unsigned long* calibration_code){
+  
+  if( !IsAdcActive(adc_number))
+    return kAdcNotInitialised;
+  
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  DMA_Channel_TypeDef* selected_dma_channel = GetDmaChannelBase(adc_number);
+  TIM_TypeDef* selected_timer = GetTriggerTimerBase(adc_number);
+  
+  if( (selected_adc == nullptr) || (selected_dma_channel == nullptr) || (selected_timer == nullptr) )
+    return kError;
+  
+  if( !(selected_adc->CR2 & ADC_CR2_ADON) )
+    return kError;
+  
+  if( (port_dual_mode == kFastInterleavedMode) && (selected_adc->CR2 & ADC_CR2_DMA) )
+    return kError;
+  
+  //injected conversion (e.g. background reference) is not yet over
+  if( (selected_adc->SR & ADC_SR_JSTRT) && !(selected_adc->SR & ADC_SR_JEOC) )
+    return kValueNotReady;
+  
+  const bool triggers_running = (selected_timer->CR1 & TIM_CR1_CEN);
+  
+  if(triggers_running){
+    selected_timer->CR1 &= ~TIM_CR1_CEN;   //hold next trigger
+    
+    const unsigned long ticks_per_count = selected_timer->PSC + 1;
+    const unsigned long ticks_since_trigger = selected_timer->CNT * ticks_per_count;
+    const unsigned long ticks_till_trigger = (selected_timer->ARR - selected_timer->CNT) * ticks_per_count;
+    const unsigned long calibration_ticks = kCalibrationAdcCycles * kPrescalerDivider[portReadAdcPrescaler()] 
+                                            * (adc_configTRIGGER_TIMER_CLOCK / 1000000UL) / (adc_configADC_INPUT_CLOCK / 1000000UL);
+    
+    //idle: no sequence is partially transferred, and the sequence started by the last trigger is over
+    const bool adc_idle = (selected_dma_channel->CNDTR % portGetSequenceLength(selected_adc) == 0)
+                          && (ticks_since_trigger >= portGetSequenceTimerTicks(selected_adc));
+    
+    if( (!adc_idle) || (ticks_till_trigger < 2 * calibration_ticks) ){
+      selected_timer->CR1 |= TIM_CR1_CEN;
+      return kValueNotReady;
+    }
+  }
+  else {
+    for(volatile int i = 0; i < kAdcStabilisationLoops; i++){
+      ;                         //ADC must be powered up for at least 2 ADC cycles before calibration
+    }
+  }
+  
+  portEnableCycleCounter();
+  const uint32_t start_cycles = DWT->CYCCNT;
+  
+  //calibration code is left in DR, it is not a conversion result for DMA
+  const uint32_t dma_request = selected_adc->CR2 & ADC_CR2_DMA;
+  selected_adc->CR2 &= ~ADC_CR2_DMA;
+  
+  const bool calibrated = portRunCalibration( selected_adc, GetSlaveAdcBase(adc_number) );
+  *calibration_code = selected_adc->DR & 0x7FUL;
+  
+  selected_adc->CR2 |= dma_request;
+  
+  const uint32_t elapsed_cycles = DWT->CYCCNT - start_cycles;
+  
+  if(triggers_running){
+    const unsigned long long held_ticks = (unsigned long long) elapsed_cycles * adc_configTRIGGER_TIMER_CLOCK / SystemCoreClock;
+    const unsigned long held_counts = held_ticks / (selected_timer->PSC + 1);
+    
+    if(selected_timer->CNT + held_counts < selected_timer->ARR)
+      selected_timer->CNT += held_counts;
+    selected_timer->CR1 |= TIM_CR1_CEN;
+  }
+  
+  *duration_ns = static_cast<unsigned long>( (unsigned long long) elapsed_cycles * 1000000000ULL / SystemCoreClock );
+  
+  return calibrated ? kOk : kError;
+}
+
+
+  //Analog watchdog of regular conversions: single channel (AWDSGL), or all of them with kNoChannel
+  //Its interrupt (ADC1_2) has the same priority as block interrupt, so they do not preempt each other
+ReturnState portSetAnalogWatchdog(const AdcHardwareNumber adc_number, const AdcChannel channel, const AdcSample low_threshold, const AdcSample high_threshold){
+  
+  if( !IsAdcActive(adc_number))
+    return kAdcNotInitialised;
+  
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  
+  if( (selected_adc == nullptr) || (adc_number != kAdc1) )
+    return kError;
+  
+  selected_adc->CR1 &= ~(ADC_CR1_AWDEN | ADC_CR1_AWDIE | ADC_CR1_AWDSGL | ADC_CR1_AWDCH);
+  
+  selected_adc->LTR = low_threshold;
+  selected_adc->HTR = high_threshold;
+  
+  if(channel != kNoChannel)
+    selected_adc->CR1 |= ADC_CR1_AWDSGL | (channel << ADC_CR1_AWDCH_Pos);
+  
+  selected_adc->SR = ~ADC_SR_AWD;       //status flags are cleared by writing 0, other flags are kept
+  
+  NVIC_SetPriority( ADC1_2_IRQn, adc_configIRQ_PRIORITY );
+  NVIC_EnableIRQ( ADC1_2_IRQn );
+  
+  selected_adc->CR1 |= ADC_CR1_AWDEN | ADC_CR1_AWDIE;
+  return kOk;
+}
+
+
+  //enables watchdog interrupt again, after it has reported crossing
+void portArmAnalogWatchdog(const AdcHardwareNumber adc_number){
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  
+  if( (selected_adc == nullptr) || !(selected_adc->CR1 & ADC_CR1_AWDEN) )
+    return;
+  
+  selected_adc->SR = ~ADC_SR_AWD;
+  selected_adc->CR1 |= ADC_CR1_AWDIE;
+}
+
+
+void portClearAnalogWatchdog(const AdcHardwareNumber adc_number){
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  
+  if(selected_adc == nullptr)
+    return;
+  
+  selected_adc->CR1 &= ~(ADC_CR1_AWDEN | ADC_CR1_AWDIE);
+  selected_adc->SR = ~ADC_SR_AWD;
+}
+
+
+  //Channel and sample of conversion, which has triggered watchdog. Interrupt is entered right after its end of conversion,
+  //when DMA has already transferred it: the last transferred sample of sequence is the one, DR still holds it
+  //Watchdog interrupt is disabled till manager arms it again, otherwise each further sample out of thresholds would raise it
+static void portServeWatchdogInterrupt(const AdcHardwareNumber adc_number){
+  ADC_TypeDef* selected_adc = GetAdcBase(adc_number);
+  DMA_Channel_TypeDef* selected_dma_channel = GetDmaChannelBase(adc_number);
+  
+  if( (selected_adc == nullptr) || (selected_dma_channel == nullptr) )
+    return;
+  
+  selected_adc->CR1 &= ~ADC_CR1_AWDIE;
+  selected_adc->SR = ~ADC_SR_AWD;
+  
+  AdcChannel channel;
+  
+  if(selected_adc->CR1 & ADC_CR1_AWDSGL){
+    channel = static_cast<AdcChannel>( (selected_adc->CR1 & ADC_CR1_AWDCH) >> ADC_CR1_AWDCH_Pos );
+  }
+  else {
+    //buffer holds a whole number of sequences, so position in sequence follows from remaining transfers alone
+    const int sequence_length = portGetSequenceLength(selected_adc);
+    const int last_slot = sequence_length - 1 - (selected_dma_channel->CNDTR % sequence_length);
+    channel = portReadSequenceChannel( selected_adc, last_slot );
+  }
+  
+  HandleWatchdogEvent( adc_number, channel, static_cast<AdcSample>(selected_adc->DR & 0xFFFFUL) );
+}
+
+
+  //DWT cycle counter runs at core clock
+unsigned long portGetCycleFrequency(){
+  return SystemCoreClock;
+}
+
+
+  //Reads DWT cycle counter and CPU cycles since the last trigger of scan sequence (from counter of trigger timer)
+  //Called from block interrupt. In fast interleaved mode ADC converts continuously, there is no trigger to refer to
+void portReadTriggerTime(const AdcHardwareNumber adc_number, unsigned long* cycle_count, unsigned long* cycles_since_trigger){
+  
+  TIM_TypeDef* selected_timer = GetTriggerTimerBase(adc_number);
+  
+  unsigned long long ticks_since_trigger = 0;
+  if( (selected_timer != nullptr) && (port_dual_mode != kFastInterleavedMode) )
+    ticks_since_trigger = (unsigned long long) selected_timer->CNT * (selected_timer->PSC + 1);
+  
+  *cycle_count = DWT->CYCCNT;
+  *cycles_since_trigger = static_cast<unsigned long>( ticks_since_trigger * SystemCoreClock / adc_configTRIGGER_TIMER_CLOCK );
+}
+
+
+  //in samples: each 32-bit transfer of dual mode carries two of them
+int portGetRemainingTransfers(const AdcHardwareNumber adc_number){
+  DMA_Channel_TypeDef* selected_dma_channel = GetDmaChannelBase(adc_number);
+  
+  if(selected_dma_channel == nullptr)
+    return 0;
+  
+  if(GetSlaveAdcBase(adc_number) != nullptr)
+    return 2 * selected_dma_channel->CNDTR;
+  
+  return selected_dma_channel->CNDTR;
+}
+
+
+void portMaskBlockInterrupt(const AdcHardwareNumber adc_number){
+  NVIC_DisableIRQ( GetDmaIrq(adc_number) );
+}
+
+
+void portUnmaskBlockInterrupt(const AdcHardwareNumber adc_number){
+  NVIC_EnableIRQ( GetDmaIrq(adc_number) );
+}
+
+}               //namespace stm32adc
+
+
+extern "C" void ADC1_2_IRQHandler(void){
+  if( (ADC1->CR1 & ADC_CR1_AWDIE) && (ADC1->SR & ADC_SR_AWD) )
+    stm32adc::portServeWatchdogInterrupt( stm32adc::kAdc1 );
+}
+
+
+extern "C" void DMA1_Channel1_IRQHandler(void){
+  const uint32_t flags = DMA1->ISR;
+  
+  if( flags & DMA_ISR_HTIF1 ){
+    DMA1->IFCR = DMA_IFCR_CHTIF1;
+    stm32adc::HandleBlockComplete( stm32adc::kAdc1, stm32adc::kFirstHalf );
+  }
+  
+  if( flags & DMA_ISR_TCIF1 ){
+    DMA1->IFCR = DMA_IFCR_CTCIF1;
+    stm32adc::HandleBlockComplete( stm32adc::kAdc1, stm32adc::kSecondHalf );
+  }
+}
\ No newline at end of file
@@ -7,6 +7,8 @@
 #include "stm32adc_manager.h"
 
 namespace stm32adc {
+
+extern unsigned long portGetCycleFrequency();
   
 static std::map<AdcHardwareNumber, AdcManager> active_adc_map = {};  
 
@@ -19,8 +21,26 @@ static AdcManager* GetAdcManager(const AdcHardwareNumber adc_number){
 }
   
 
+  //ADC2 is slave of ADC1 in dual mode, then it is used only through its master
+static bool IsDualModeConflict( const AdcHardwareNumber adc_number, const AdcConfiguration &configuration ){
+  
+  if( configuration.dual_mode != kIndependentMode )
+    return (adc_number != kAdc1) || (GetAdcManager(kAdc2) != nullptr);
+  
+  if( adc_number == kAdc2 ){
+    AdcManager* master = GetAdcManager(kAdc1);
+    return (master != nullptr) && (master->GetDualMode() != kIndependentMode);
+  }
+  
+  return false;
+}
+  
+
 ReturnState InitAdc( const AdcHardwareNumber adc_number, const AdcConfiguration &configuration){
   
+  if( IsDualModeConflict(adc_number, configuration) )
+    return kError;
+  
   active_adc_map.erase(adc_number);
   active_adc_map.emplace( std::piecewise_construct, std::forward_as_tuple(adc_number), std::forward_as_tuple(adc_number, configuration) );
   
@@ -56,6 +76,46 @@ ReturnState GetCurrentValue( const AdcHardwareNumber adc_number, const AdcChanne
   return adc_manager->GetChannelValue( channel, value ); 
 }
 
+ReturnState ConvertChannelsOnce( const AdcHardwareNumber adc_number, const AdcChannel* channels, const int channels_amount, AdcValue* values ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->ConvertChannelsOnce( channels, channels_amount, values );
+}
+
+ReturnState SetChannelOversampling( const AdcHardwareNumber adc_number, const AdcChannel channel, const OversamplingOrder order ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->SetChannelOversampling( channel, order );
+}
+
+ReturnState SetChannelSampleTime( const AdcHardwareNumber adc_number, const AdcChannel channel, const SampleTime sample_time ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->SetChannelSampleTime( channel, sample_time );
+}
+
+ReturnState SetAdcPrescaler( const AdcHardwareNumber adc_number, const AdcPrescaler prescaler ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->SetAdcPrescaler( prescaler );
+}
+
 ReturnState RemoveChannelFromScanList( const AdcHardwareNumber adc_number, const AdcChannel channel_to_remove ){ 
    
   AdcManager* adc_manager = GetAdcManager(adc_number);
@@ -66,4 +126,180 @@ ReturnState RemoveChannelFromScanList( const AdcHardwareNumber adc_number, const
   return adc_manager->RemoveChannelFromScanList( channel_to_remove );
 }
 
+ReturnState SubscribeToChannelSamples( const AdcHardwareNumber adc_number, 
+                                       const AdcChannel channel, 
+                                       const SamplesHandler handler, 
+                                       void* context ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->Subscribe( channel, handler, context );
+}
+
+ReturnState UnsubscribeFromChannelSamples( const AdcHardwareNumber adc_number, const AdcChannel channel, void* context ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->Unsubscribe( channel, context );
+}
+
+ReturnState GetSampleRate( const AdcHardwareNumber adc_number, SampleRate *rate ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  *rate = adc_manager->GetSampleRate();
+  return kOk;
+}
+
+ReturnState GetAchievableSampleRate( const AdcHardwareNumber adc_number, SampleRate *rate ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  *rate = adc_manager->GetAchievableSampleRate();
+  return kOk;
+}
+
+ReturnState GetChannelsCapacity( const AdcHardwareNumber adc_number, int *capacity ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  *capacity = adc_manager->GetChannelsCapacity();
+  return kOk;
+}
+
+ReturnState GetSupplyVoltage( const AdcHardwareNumber adc_number, SupplyVoltage *vdda ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->GetSupplyVoltage( vdda );
+}
+
+ReturnState GetSupplyCorrection( const AdcHardwareNumber adc_number, SupplyCorrection *correction ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr){
+    *correction = kUnitySupplyCorrection;
+    return kAdcNotInitialised;
+  }
+  
+  return adc_manager->GetSupplyCorrection( correction );
+}
+
+ReturnState SetAnalogWatchdog( const AdcHardwareNumber adc_number, 
+                               const AdcChannel channel, 
+                               const AdcSample low_threshold, 
+                               const AdcSample high_threshold,
+                               const ThresholdHandler handler,
+                               void* context ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->SetAnalogWatchdog( channel, low_threshold, high_threshold, handler, context );
+}
+
+ReturnState ClearAnalogWatchdog( const AdcHardwareNumber adc_number ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->ClearAnalogWatchdog();
+}
+
+ReturnState SetChannelThresholds( const AdcHardwareNumber adc_number, 
+                                  const AdcChannel channel, 
+                                  const AdcSample low_threshold, 
+                                  const AdcSample high_threshold,
+                                  const ThresholdHandler handler,
+                                  void* context ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->SetChannelThresholds( channel, low_threshold, high_threshold, handler, context );
+}
+
+ReturnState ClearChannelThresholds( const AdcHardwareNumber adc_number, const AdcChannel channel ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  return adc_manager->ClearChannelThresholds( channel );
+}
+
+ReturnState GetCalibrationStatistics( const AdcHardwareNumber adc_number, CalibrationStatistics *statistics ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  adc_manager->GetCalibrationStatistics( statistics );
+  return kOk;
+}
+
+ReturnState GetTimingStatistics( const AdcHardwareNumber adc_number, TimingStatistics *statistics ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return kAdcNotInitialised;
+  
+  adc_manager->GetTimingStatistics( statistics );
+  return kOk;
+}
+
+unsigned long GetTimestampFrequency(){
+  return portGetCycleFrequency();
+}
+
+  //called by port from interrupt, when DMA has completed one half of buffer
+void HandleBlockComplete( const AdcHardwareNumber adc_number, const BufferHalf completed_half ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return;
+  
+  adc_manager->DeliverBlock( completed_half );
+}
+
+  //called by port from ADC interrupt, when analog watchdog has detected sample of -channel- out of thresholds
+void HandleWatchdogEvent( const AdcHardwareNumber adc_number, const AdcChannel channel, const AdcSample sample ){
+  
+  AdcManager* adc_manager = GetAdcManager(adc_number);
+  
+  if(adc_manager == nullptr)
+    return;
+  
+  adc_manager->ReportWatchdogEvent( channel, sample );
+}
+
 }                       //namespace stm32adc
\ No newline at end of file
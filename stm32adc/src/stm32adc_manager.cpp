@@ -1,5 +1,6 @@
 //file stm32adc_manager.cpp
 #include <list>
+#include <iterator>
 
 #include "stm32adc.h"
 #include "stm32adc_manager.h"
@@ -9,56 +10,326 @@ namespace stm32adc {
 extern const int port_kAvailableAdcChannelsAmount;
 
 extern ReturnState portChannelAvailable(const AdcChannel channel_to_add);
-extern ReturnState portInitAdc(const AdcHardwareNumber adc_number, AdcValue* buffer_address);
-extern ReturnState portPerformScanning(const AdcHardwareNumber adc_number, const std::list<AdcChannel> &channels);
+extern SampleRate portMaxSampleRate(const AdcHardwareNumber adc_number, const AdcPrescaler prescaler, const SampleTime* sample_times, const int channels_amount);
+extern ReturnState portInitAdc(const AdcHardwareNumber adc_number, AdcSample* buffer_address, const SampleRate sample_rate, const DualMode dual_mode);
+extern ReturnState portPerformScanning(const AdcHardwareNumber adc_number, const AdcChannel* sequence, const int samples_amount, const int sequences_amount, const AdcTiming &timing);
+extern ReturnState portApplyChannelsSequence(const AdcHardwareNumber adc_number, const AdcChannel* sequence, const int samples_amount, const int sequences_amount, const AdcTiming &timing);
+extern ReturnState portConvertInjected(const AdcHardwareNumber adc_number, const AdcChannel* channels, const SampleTime* sample_times, const int channels_amount, AdcSample* results);
+extern ReturnState portStartInjected(const AdcHardwareNumber adc_number, const AdcChannel* channels, const SampleTime* sample_times, const int channels_amount);
+extern ReturnState portReadInjected(const AdcHardwareNumber adc_number, AdcSample* results, const int channels_amount);
+extern ReturnState portCalibrateAdc(const AdcHardwareNumber adc_number, unsigned long* duration_ns, unsigned long* calibration_code);
+extern ReturnState portSetAnalogWatchdog(const AdcHardwareNumber adc_number, const AdcChannel channel, const AdcSample low_threshold, const AdcSample high_threshold);
+extern void portArmAnalogWatchdog(const AdcHardwareNumber adc_number);
+extern void portClearAnalogWatchdog(const AdcHardwareNumber adc_number);
+extern int portGetRemainingTransfers(const AdcHardwareNumber adc_number);
+extern void portMaskBlockInterrupt(const AdcHardwareNumber adc_number);
+extern void portUnmaskBlockInterrupt(const AdcHardwareNumber adc_number);
+extern unsigned long portGetCycleFrequency();
+extern void portReadTriggerTime(const AdcHardwareNumber adc_number, unsigned long* cycle_count, unsigned long* cycles_since_trigger);
   
 static const int kInvalidIndex = -1;
 
+  //VREFINT input, it needs at least 17.1us of sampling: the longest sampling time at any allowed ADC clock
+static const AdcChannel kReferenceChannel = kCh17;
+static const SampleTime kReferenceSampleTime = kSampleTime239_5;
+static const int kSupplyFilterFraction = 4;
 
-bool AdcManager::HaveChannelInScanList(const AdcChannel channel){
-  for(auto it = channels_.begin(); it != channels_.end(); it++){
-    if(*it == channel)
-      return true;
+
+  //channel is in scan list from the moment it is requested, even if scan list is not yet switched
+bool AdcManager::HaveChannelInScanList(const AdcChannel channel) const{
+  if( (channel < kCh0) || (channel >= kChannelsAmount) )
+    return false;
+  return channel_requested_[channel];
+}
+
+
+int AdcManager::GetChannelIndex(const AdcChannel channel) const{
+  if( (channel < kCh0) || (channel >= kChannelsAmount) )
+    return kInvalidIndex;
+  return channel_slot_[channel];
+}
+
+
+  //index of the last scan sequence, completely written by DMA into buffer during current pass,
+  //kInvalidIndex if DMA has just wrapped and the first sequence is not yet completed
+int AdcManager::GetLastCompletedSequence(){
+  const int samples_amount = sequence_samples_;
+  
+  if(samples_amount == 0)
+    return kInvalidIndex;
+  
+  const int sequences_amount = kBufferHalvesAmount * block_length_;
+  const int written = samples_amount * sequences_amount - portGetRemainingTransfers( adc_number_ );
+  const int sequence = written / samples_amount - 1;
+  
+  if( sequence < 0 )
+    return kInvalidIndex;
+  
+  return sequence;
+}
+
+
+  //samples in one scan sequence of -channels_amount- channels: 
+  //pair of ADC in dual mode always writes both samples
+int AdcManager::GetSequenceSamples(const int channels_amount) const{
+  switch(dual_mode_){
+  case kRegularSimultaneousMode:
+    return channels_amount + (channels_amount % 2);
+  case kFastInterleavedMode:
+    return 2 * channels_amount;
+  default:
+    return channels_amount;
   }
-  return false;
 }
 
 
-int AdcManager::GetChannelIndex(const AdcChannel channel){
-  int index = 0;
-  for(auto it = channels_.begin(); it != channels_.end(); it++){
-    if(*it == channel)
-      return index;
-    index++;
+  //Fills -sequence- with channels of samples of requested scan list, returns amount of samples
+int AdcManager::BuildScanSequence(AdcChannel* sequence) const{
+  const int samples_amount = GetSequenceSamples(requested_channels_);
+  
+  for(int slot = 0; slot < samples_amount; slot++){
+    if(dual_mode_ == kFastInterleavedMode)
+      sequence[slot] = requested_order_[0];
+    else if(slot < requested_channels_)
+      sequence[slot] = requested_order_[slot];
+    else
+      sequence[slot] = kNoChannel;          //slave sample of unpaired channel
   }
-  return kInvalidIndex;
+  
+  return samples_amount;
 }
 
 
-void AdcManager::InvalidateBufferValues(){
-  if(!initialised_)
-    return;
-  for(int i = 0; i < allocated_buffer_size_; i++)
-    buffer_[i] = kInvalidValue;
+  //Highest sample rate for requested scan list, extended by -added_amount- channels -added_channels-
+  //and by -added_default_channels- channels of default sampling time, if ADC had -timing-
+SampleRate AdcManager::PlanSampleRate(const AdcTiming &timing, const AdcChannel* added_channels, const int added_amount, const int added_default_channels) const{
+  SampleTime sample_times[kChannelsAmount + kMaxInjectedChannels];
+  int channels_amount = 0;
+  
+  for(int slot = 0; slot < requested_channels_; slot++)
+    sample_times[channels_amount++] = timing.sample_time[requested_order_[slot]];
+  
+  for(int i = 0; (i < added_amount) && (channels_amount < kChannelsAmount + kMaxInjectedChannels); i++){
+    if( (added_channels[i] >= kCh0) && (added_channels[i] < kChannelsAmount) )
+      sample_times[channels_amount++] = timing.sample_time[added_channels[i]];
+  }
+  
+  for(int i = 0; (i < added_default_channels) && (channels_amount < kChannelsAmount + kMaxInjectedChannels); i++)
+    sample_times[channels_amount++] = adc_configDEFAULT_SAMPLE_TIME;
+  
+  if(channels_amount == 0)
+    return 0;
+  
+  if(dual_mode_ == kFastInterleavedMode)
+    return (channels_amount == 1) ? sample_rate_ : 0;
+  
+  //pair is converted at once and takes as long as the longer of its channels
+  if(dual_mode_ == kRegularSimultaneousMode){
+    int pairs_amount = 0;
+    for(int i = 0; i < channels_amount; i += 2){
+      SampleTime longer = sample_times[i];
+      if( (i + 1 < channels_amount) && (sample_times[i + 1] > longer) )
+        longer = sample_times[i + 1];
+      sample_times[pairs_amount++] = longer;
+    }
+    channels_amount = pairs_amount;
+  }
+  
+  return portMaxSampleRate( adc_number_, timing.prescaler, sample_times, channels_amount );
+}
+
+
+  //Running scan list is switched at buffer wrap, so that channels being scanned do not lose samples
+  //Without running channels there is nothing to preserve, then scanning is restarted at once
+ReturnState AdcManager::UpdateScanList(){
+  
+  if( (sequence_samples_ > 0) && (requested_channels_ > 0) ){
+    reconfiguration_pending_ = true;
+    return kOk;
+  }
+  
+  AdcChannel sequence[kChannelsAmount];
+  const int samples_amount = BuildScanSequence(sequence);
+  
+  if( portPerformScanning( adc_number_, sequence, samples_amount, kBufferHalvesAmount * block_length_, timing_ ) != kOk )
+    return kError;
+  
+  for(int channel = kCh0; channel < kChannelsAmount; channel++)
+    pass_end_value_ready_[channel] = false;
+  
+  ActivateScanSequence(sequence, samples_amount);
+  scan_list_changed_ = true;
+  RestartBlockTiming();
+  return kOk;
+}
+
+
+  //called from interrupt first thing after buffer wrap: switch succeeds only before the next trigger,
+  //which comes one sequence period after the wrap. Returns true, if hardware converts -sequence- from now on
+  //Samples of completed pass are still to be delivered with the old sequence (see CompleteScanListSwitch())
+bool AdcManager::SwitchToRequestedScanList(AdcChannel* sequence, int* samples_amount){
+  
+  if(!reconfiguration_pending_)
+    return false;
+  
+  *samples_amount = BuildScanSequence(sequence);
+  
+  //fails if next sequence has already been started, then it is retried at next wrap
+  return portApplyChannelsSequence( adc_number_, sequence, *samples_amount, kBufferHalvesAmount * block_length_, timing_ ) == kOk;
+}
+
+
+  //called from interrupt after the completed pass is delivered: only the latest value of each channel is kept,
+  //then channels get slots of the new sequence
+void AdcManager::CompleteScanListSwitch(const AdcChannel* sequence, const int samples_amount){
+  
+  const AdcSample* last_sequence = buffer_ + (kBufferHalvesAmount * block_length_ - 1) * sequence_samples_;
+  
+  for(int channel = kCh0; channel < kChannelsAmount; channel++)
+    pass_end_value_ready_[channel] = false;
+  
+  for(int slot = 0; slot < sequence_samples_; slot++){
+    if(scan_order_[slot] == kNoChannel)
+      continue;
+    pass_end_value_[scan_order_[slot]] = last_sequence[slot];
+    pass_end_value_ready_[scan_order_[slot]] = true;
+  }
+  
+  ActivateScanSequence(sequence, samples_amount);
+  scan_list_changed_ = true;
+}
+
+
+  //-sequence- becomes the converted one: channels get their new slots
+  //Channel sampled more than once per sequence (fast interleaved mode) gets slot of its first sample
+void AdcManager::ActivateScanSequence(const AdcChannel* sequence, const int samples_amount){
+  
+  for(int slot = 0; slot < sequence_samples_; slot++){
+    if(scan_order_[slot] != kNoChannel)
+      channel_slot_[scan_order_[slot]] = kInvalidIndex;
+  }
+  
+  for(int slot = 0; slot < kChannelsAmount; slot++)
+    scan_order_[slot] = (slot < samples_amount) ? sequence[slot] : kNoChannel;
+  
+  sequence_samples_ = samples_amount;
+  
+  for(int slot = 0; slot < sequence_samples_; slot++){
+    const AdcChannel channel = scan_order_[slot];
+    if( (channel != kNoChannel) && (channel_slot_[channel] == kInvalidIndex) )
+      channel_slot_[channel] = slot;
+  }
+  
+  reconfiguration_pending_ = false;
+}
+
+
+  //samples of channel at -slot- within block, beginning at -half_start-
+  //In fast interleaved mode all samples of block belong to the single channel
+ChannelSamples AdcManager::GetBlockSamples(const AdcSample* half_start, const int slot) const{
+  const Timestamp first_sequence_time = block_time_ - block_period_ + block_period_ / block_length_;
+  
+  if(dual_mode_ == kFastInterleavedMode)
+    return { half_start, 1, block_length_ * sequence_samples_, first_sequence_time, 
+             static_cast<unsigned long>( block_period_ / (block_length_ * sequence_samples_) ) };
+  
+  return { half_start + slot, sequence_samples_, block_length_, first_sequence_time, 
+           static_cast<unsigned long>( block_period_ / block_length_ ) };
+}
+
+
+void AdcManager::ResetOversampling(const AdcChannel channel){
+  oversampling_order_[channel] = 0;
+  oversampling_sum_[channel] = 0;
+  oversampling_counter_[channel] = 0;
+  oversampled_value_[channel] = kInvalidValue;
+  oversampled_value_ready_[channel] = false;
+}
+
+
+  //called from interrupt for each completed block of oversampled channel
+void AdcManager::AccumulateOversampling(const AdcChannel channel, const ChannelSamples &samples){
+  const OversamplingOrder order = oversampling_order_[channel];
+  const int samples_per_value = 1 << (2 * order);
+  
+  for(int i = 0; i < samples.amount; i++){
+    oversampling_sum_[channel] += samples.first[i * samples.stride];
+    oversampling_counter_[channel]++;
+    
+    if(oversampling_counter_[channel] == samples_per_value){
+      oversampled_value_[channel] = oversampling_sum_[channel] >> order;
+      oversampled_value_ready_[channel] = true;
+      oversampling_sum_[channel] = 0;
+      oversampling_counter_[channel] = 0;
+    }
+  }
 }
 
 
 AdcManager::AdcManager( const AdcHardwareNumber adc_number, const AdcConfiguration &configuration ) {
   adc_number_ = adc_number;
-  channels_ = {};
+  dual_mode_ = configuration.dual_mode;
+  sequence_samples_ = 0;
+  requested_channels_ = 0;
+  reconfiguration_pending_ = false;
+  scan_list_changed_ = false;
+  subscriptions_ = {};
   initialised_ = false;
+  sample_rate_ = configuration.sample_rate;
+  block_length_ = configuration.block_length > 0 ? configuration.block_length : 1;
+  
+  reference_filter_ = 0;
+  supply_voltage_ = kNominalSupplyVoltage;
+  supply_correction_ = kUnitySupplyCorrection;
+  supply_ready_ = false;
+  reference_block_counter_ = 0;
+  reference_pending_ = false;
+  
+  recalibration_period_blocks_ = 0;
+  recalibration_block_counter_ = 0;
+  recalibration_due_ = false;
+  calibration_statistics_ = {};
+  
+  watchdog_ = {};
+  watchdog_channel_ = kNoChannel;
+  watchdog_armed_ = false;
+  
+  cycle_count_high_ = 0;
+  last_cycle_count_ = 0;
+  nominal_block_period_ = 0;
+  block_time_ = 0;
+  block_period_ = 0;
+  RestartBlockTiming();
   
   if( configuration.max_simultaneously_scanned_channels > port_kAvailableAdcChannelsAmount )
-    allocated_buffer_size_ = port_kAvailableAdcChannelsAmount;
+    allocated_channels_ = port_kAvailableAdcChannelsAmount;
   else
-    allocated_buffer_size_ = configuration.max_simultaneously_scanned_channels;
+    allocated_channels_ = configuration.max_simultaneously_scanned_channels;
   
-  buffer_ = new AdcValue[allocated_buffer_size_]; 
+  if( (dual_mode_ == kFastInterleavedMode) && (allocated_channels_ > 1) )
+    allocated_channels_ = 1;
+  
+  timing_.prescaler = configuration.adc_prescaler;
+  
+  for(int channel = kCh0; channel < kChannelsAmount; channel++){
+    scan_order_[channel] = kNoChannel;
+    channel_slot_[channel] = kInvalidIndex;
+    requested_order_[channel] = kNoChannel;
+    channel_requested_[channel] = false;
+    pass_end_value_[channel] = kInvalidValue;
+    pass_end_value_ready_[channel] = false;
+    timing_.sample_time[channel] = adc_configDEFAULT_SAMPLE_TIME;
+    thresholds_[channel] = {};
+    ResetOversampling( static_cast<AdcChannel>(channel) );
+  }
+  
+  //ping-pong buffer: DMA fills one half, while completed one is delivered to subscribers
+  buffer_ = new AdcSample[GetSequenceSamples(allocated_channels_) * block_length_ * kBufferHalvesAmount]; 
 }
 
 
 AdcManager::~AdcManager() {
-  delete buffer_;
+  delete[] buffer_;
 }
 
 
@@ -67,7 +338,38 @@ ReturnState AdcManager::Init( const AdcHardwareNumber adc_number ) {
   if(buffer_ == nullptr)
     return kError;
   
-  ReturnState init_status = portInitAdc( adc_number, buffer_ );
+  //both ADC convert with the shortest sampling time, their conversions are shifted by half of conversion time
+  if(dual_mode_ == kFastInterleavedMode){
+    const SampleTime interleaved_sample_time = kSampleTime1_5;
+    sample_rate_ = 2 * portMaxSampleRate( adc_number, timing_.prescaler, &interleaved_sample_time, 1 );
+    if(sample_rate_ == 0)
+      return kError;
+  }
+  
+  //blocks are delivered at sample_rate_ / block_length_ per second
+  reference_period_blocks_ = static_cast<int>( (long long) sample_rate_ * adc_configSUPPLY_UPDATE_PERIOD_MS / 1000 / block_length_ );
+  if(reference_period_blocks_ < 1)
+    reference_period_blocks_ = 1;
+  
+  //ADC never pauses in fast interleaved mode, so it is calibrated only once
+  if( (adc_configRECALIBRATION_PERIOD_MS > 0) && (dual_mode_ != kFastInterleavedMode) ){
+    recalibration_period_blocks_ = static_cast<int>( (long long) sample_rate_ * adc_configRECALIBRATION_PERIOD_MS / 1000 / block_length_ );
+    if(recalibration_period_blocks_ < 1)
+      recalibration_period_blocks_ = 1;
+  }
+  
+  //in fast interleaved mode each sequence holds two samples of the channel
+  const SampleRate sequence_rate = (dual_mode_ == kFastInterleavedMode) ? sample_rate_ / 2 : sample_rate_;
+  if(sequence_rate <= 0)
+    return kError;
+  nominal_block_period_ = (Timestamp) portGetCycleFrequency() * block_length_ / sequence_rate;
+  block_period_ = nominal_block_period_;
+  
+  ReturnState init_status = portInitAdc( adc_number, buffer_, sample_rate_, dual_mode_ );
+  
+  //scanning is not started yet, ADC is idle
+  if( (init_status == kOk) && (Calibrate() != kOk) )
+    init_status = kError;
   
   if(init_status == kOk)
     initialised_ = true;
@@ -87,20 +389,31 @@ ReturnState AdcManager::AddChannelToScanList( const AdcChannel new_channel ) {
   if( portChannelAvailable(new_channel) != kOk)
     return kError;
   
-  if( channels_.size() >= allocated_buffer_size_ )
+  if( requested_channels_ >= allocated_channels_ )
     return kChannelsLimitReached;
-    
-  channels_.push_back(new_channel);
   
-  InvalidateBufferValues();
+  if( PlanSampleRate( timing_, &new_channel, 1, 0 ) < sample_rate_ )
+    return kChannelsLimitReached;
   
-  if( portPerformScanning( adc_number_, channels_ ) != kOk ) {
-    channels_.pop_back();
-    portPerformScanning( adc_number_, channels_ ); 
-    return kError;
+  portMaskBlockInterrupt( adc_number_ );
+  
+  //new channel takes the last slot, so running channels keep their positions
+  requested_order_[requested_channels_] = new_channel;
+  requested_channels_++;
+  channel_requested_[new_channel] = true;
+  
+  ReturnState result = UpdateScanList();
+  
+  if( result != kOk ) {
+    requested_channels_--;
+    requested_order_[requested_channels_] = kNoChannel;
+    channel_requested_[new_channel] = false;
+    result = kError;
   }
   
-  return kOk;
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return result;
 }
 
 
@@ -110,32 +423,697 @@ ReturnState AdcManager::GetChannelValue( const AdcChannel channel, AdcValue* val
   if(!initialised_)
     return kError;
   
-  int index = GetChannelIndex( channel );
-  
-  if(index == kInvalidIndex)
+  if( !HaveChannelInScanList(channel) )
     return kChannelNotActive;
   
-  *value = buffer_[index];
+  ReturnState result = kOk;
+  
+  //scan list may be switched by block interrupt, slots are read under mask
+  portMaskBlockInterrupt( adc_number_ );
+  
+  const int index = GetChannelIndex( channel );
+  const int sequence = GetLastCompletedSequence();
+  
+  if(index == kInvalidIndex){
+    result = kValueNotReady;            //requested, but scan list is not yet switched
+  }
+  else if(oversampling_order_[channel] > 0){
+    if(oversampled_value_ready_[channel])
+      *value = oversampled_value_[channel];
+    else
+      result = kValueNotReady;
+  }
+  else if(sequence != kInvalidIndex){
+    *value = buffer_[sequence * sequence_samples_ + index];
+  }
+  else if(!scan_list_changed_){
+    *value = buffer_[(kBufferHalvesAmount * block_length_ - 1) * sequence_samples_ + index];
+  }
+  else if(pass_end_value_ready_[channel]){
+    *value = pass_end_value_[channel];
+  }
+  else {
+    result = kValueNotReady;
+  }
+  
+  portUnmaskBlockInterrupt( adc_number_ );
+
+  return result;
+}
+
+
+ReturnState AdcManager::ConvertChannelsOnce( const AdcChannel* channels, const int channels_amount, AdcValue* values ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  if( (channels_amount < 1) || (channels_amount > kMaxInjectedChannels) )
+    return kError;
+  
+  //both ADC convert continuously, there is no gap for injected conversion
+  if(dual_mode_ == kFastInterleavedMode)
+    return kError;
+  
+  SampleTime sample_times[kMaxInjectedChannels];
+  
+  for(int i = 0; i < channels_amount; i++){
+    if( (channels[i] < kCh0) || (channels[i] >= kChannelsAmount) || (portChannelAvailable(channels[i]) != kOk) )
+      return kError;
+    sample_times[i] = timing_.sample_time[channels[i]];
+  }
+  
+  //injected conversion delays scan sequence, both should fit into one sample period
+  if( (requested_channels_ > 0) && (PlanSampleRate( timing_, channels, channels_amount, 0 ) < sample_rate_) )
+    return kRateNotAchievable;
+  
+  AdcSample results[kMaxInjectedChannels];
+  
+  //sampling time registers are shared with scan list, which may be switched from block interrupt
+  //Background reference conversion, if started, is completed first and its result is lost
+  portMaskBlockInterrupt( adc_number_ );
+  const ReturnState conversion_status = portConvertInjected( adc_number_, channels, sample_times, channels_amount, results );
+  reference_pending_ = false;
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  if(conversion_status != kOk)
+    return kError;
+  
+  for(int i = 0; i < channels_amount; i++)
+    values[i] = results[i];
+  
+  return kOk;
+}
+
 
+ReturnState AdcManager::SetChannelOversampling( const AdcChannel channel, const OversamplingOrder order ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  if( (order < 0) || (order > kMaxOversamplingOrder) )
+    return kError;
+  
+  if( !HaveChannelInScanList(channel) )
+    return kChannelNotActive;
+  
+  portMaskBlockInterrupt( adc_number_ );
+  ResetOversampling( channel );
+  oversampling_order_[channel] = order;
+  portUnmaskBlockInterrupt( adc_number_ );
+  
   return kOk;
 }
 
 
+ReturnState AdcManager::SetChannelSampleTime( const AdcChannel channel, const SampleTime sample_time ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  if( (channel < kCh0) || (channel >= kChannelsAmount) || (portChannelAvailable(channel) != kOk) )
+    return kError;
+  
+  if( (sample_time < kSampleTime1_5) || (sample_time > kSampleTime239_5) )
+    return kError;
+  
+  if(dual_mode_ == kFastInterleavedMode)
+    return kError;
+  
+  AdcTiming new_timing = timing_;
+  new_timing.sample_time[channel] = sample_time;
+  
+  if( HaveChannelInScanList(channel) && (PlanSampleRate( new_timing, nullptr, 0, 0 ) < sample_rate_) )
+    return kRateNotAchievable;
+  
+  portMaskBlockInterrupt( adc_number_ );
+  
+  timing_ = new_timing;
+  ReturnState result = kOk;
+  
+  if( HaveChannelInScanList(channel) )
+    result = UpdateScanList();
+  
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return result;
+}
+
+
+ReturnState AdcManager::SetAdcPrescaler( const AdcPrescaler prescaler ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  if( (prescaler < kAdcPrescaler2) || (prescaler > kAdcPrescaler8) )
+    return kError;
+  
+  //sample rate of fast interleaved mode is fixed by prescaler of configuration
+  if(dual_mode_ == kFastInterleavedMode)
+    return kError;
+  
+  AdcTiming new_timing = timing_;
+  new_timing.prescaler = prescaler;
+  
+  //with empty scan list prescaler is checked for a single channel of default sampling time
+  const int default_channels = (requested_channels_ == 0) ? 1 : 0;
+  
+  if( PlanSampleRate( new_timing, nullptr, 0, default_channels ) < sample_rate_ )
+    return kRateNotAchievable;
+  
+  portMaskBlockInterrupt( adc_number_ );
+  
+  timing_ = new_timing;
+  ReturnState result = kOk;
+  
+  if( requested_channels_ > 0 )
+    result = UpdateScanList();
+  
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return result;
+}
+
+
 ReturnState AdcManager::RemoveChannelFromScanList( const AdcChannel channel_to_remove ) {
   
   if(!initialised_)
     return kError;
   
-  for(auto it = channels_.begin(); it != channels_.end(); it++){
-    if(*it == channel_to_remove){
-      channels_.erase(it);
-      portPerformScanning( adc_number_, channels_ );
-      break;
+  if( !HaveChannelInScanList(channel_to_remove) )
+    return kOk;
+  
+  portMaskBlockInterrupt( adc_number_ );
+  
+  //following channels move one slot towards the beginning of scan sequence
+  int slot = 0;
+  while(requested_order_[slot] != channel_to_remove)
+    slot++;
+  
+  for( ; slot < requested_channels_ - 1; slot++)
+    requested_order_[slot] = requested_order_[slot + 1];
+  
+  requested_channels_--;
+  requested_order_[requested_channels_] = kNoChannel;
+  channel_requested_[channel_to_remove] = false;
+  
+  ResetOversampling( channel_to_remove );
+  UpdateScanList();
+  
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return kOk;
+}
+
+
+ReturnState AdcManager::Subscribe( const AdcChannel channel, const SamplesHandler handler, void* context ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  if(handler == nullptr)
+    return kError;
+  
+  //node is allocated here, with interrupt enabled, and only relinked under mask
+  std::list< SamplesSubscription > new_subscription = { {channel, handler, context} };
+  
+  portMaskBlockInterrupt( adc_number_ );
+  subscriptions_.splice( subscriptions_.end(), new_subscription );
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return kOk;
+}
+
+
+ReturnState AdcManager::Unsubscribe( const AdcChannel channel, void* context ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  //nodes are relinked under mask and freed after it, when this list goes out of scope
+  std::list< SamplesSubscription > removed_subscriptions = {};
+  
+  portMaskBlockInterrupt( adc_number_ );
+  
+  auto it = subscriptions_.begin();
+  while(it != subscriptions_.end()){
+    auto next_it = std::next(it);
+    if( (it->channel == channel) && (it->context == context) )
+      removed_subscriptions.splice( removed_subscriptions.end(), subscriptions_, it );
+    it = next_it;
+  }
+  
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return kOk;
+}
+
+
+SampleRate AdcManager::GetSampleRate() const {
+  return sample_rate_;
+}
+
+
+SampleRate AdcManager::GetAchievableSampleRate() const {
+  return PlanSampleRate( timing_, nullptr, 0, 0 );
+}
+
+
+DualMode AdcManager::GetDualMode() const {
+  return dual_mode_;
+}
+
+
+  //whole scan sequence should be converted within one trigger period
+int AdcManager::GetChannelsCapacity() const {
+  
+  int capacity = requested_channels_;
+  
+  while( (capacity < allocated_channels_) 
+        && (PlanSampleRate( timing_, nullptr, 0, capacity - requested_channels_ + 1 ) >= sample_rate_) )
+    capacity++;
+  
+  return capacity;
+}
+
+
+ReturnState AdcManager::GetSupplyVoltage( SupplyVoltage* vdda ) const {
+  *vdda = supply_voltage_;
+  
+  if(!initialised_)
+    return kError;
+  
+  return supply_ready_ ? kOk : kValueNotReady;
+}
+
+
+ReturnState AdcManager::GetSupplyCorrection( SupplyCorrection* correction ) const {
+  *correction = supply_correction_;
+  
+  if(!initialised_)
+    return kError;
+  
+  return supply_ready_ ? kOk : kValueNotReady;
+}
+
+
+  //VDDA = VREFINT * full scale / reference level. Derived values are computed here, once per reference conversion,
+  //so that readers pay nothing for them
+void AdcManager::FilterReference( const AdcSample reference ) {
+  
+  if(reference == 0)
+    return;
+  
+  const unsigned long scaled_reference = (unsigned long) reference << kSupplyFilterFraction;
+  
+  if(!supply_ready_)
+    reference_filter_ = scaled_reference;
+  else if(scaled_reference >= reference_filter_)
+    reference_filter_ += (scaled_reference - reference_filter_) >> adc_configSUPPLY_FILTER_SHIFT;
+  else
+    reference_filter_ -= (reference_filter_ - scaled_reference) >> adc_configSUPPLY_FILTER_SHIFT;
+  
+  const SupplyVoltage vdda = ( (unsigned long) adc_configVREFINT_MILLIVOLTS * kMaxAdcValue << kSupplyFilterFraction ) / reference_filter_;
+  
+  supply_voltage_ = vdda;
+  supply_correction_ = ( (unsigned long long) vdda << kSupplyCorrectionShift ) / kNominalSupplyVoltage;
+  supply_ready_ = true;
+}
+
+
+  //Returns kValueNotReady, if ADC is converting and there is no time for calibration before next trigger
+ReturnState AdcManager::Calibrate() {
+  
+  unsigned long duration_ns = 0;
+  unsigned long calibration_code = 0;
+  
+  const ReturnState calibration_status = portCalibrateAdc( adc_number_, &duration_ns, &calibration_code );
+  
+  if(calibration_status != kOk){
+    if(calibration_status == kValueNotReady)
+      calibration_statistics_.postponed++;
+    return calibration_status;
+  }
+  
+  calibration_statistics_.completed++;
+  calibration_statistics_.last_duration_ns = duration_ns;
+  if(duration_ns > calibration_statistics_.max_duration_ns)
+    calibration_statistics_.max_duration_ns = duration_ns;
+  calibration_statistics_.calibration_code = calibration_code;
+  
+  return kOk;
+}
+
+
+  //Called from block interrupt first of all, right after the last sequence of block is converted:
+  //the gap before next trigger is the longest at this moment
+void AdcManager::UpdateCalibration() {
+  
+  if(recalibration_period_blocks_ == 0)
+    return;
+  
+  if(!recalibration_due_){
+    recalibration_block_counter_++;
+    if(recalibration_block_counter_ < recalibration_period_blocks_)
+      return;
+    recalibration_block_counter_ = 0;
+    recalibration_due_ = true;
+  }
+  
+  //postponed calibration is retried at next block, other failures are not retried
+  if(Calibrate() != kValueNotReady)
+    recalibration_due_ = false;
+}
+
+
+void AdcManager::GetCalibrationStatistics( CalibrationStatistics* statistics ) {
+  portMaskBlockInterrupt( adc_number_ );
+  *statistics = calibration_statistics_;
+  portUnmaskBlockInterrupt( adc_number_ );
+}
+
+
+  //scanning is (re)started: triggers get new phase, so previous block time is no reference
+void AdcManager::RestartBlockTiming() {
+  block_time_valid_ = false;
+  timed_blocks_ = 0;
+  timing_gaps_ = 0;
+  min_block_period_ = 0;
+  max_block_period_ = 0;
+  last_latency_ = 0;
+  max_latency_ = 0;
+}
+
+
+  //Block time is the trigger of the last sequence of completed block: trigger timer tells, how long ago its last trigger was.
+  //If interrupt came so late, that next sequences are triggered already, their whole periods are subtracted.
+  //Cycle counter is 32 bits wide, it wraps in tens of seconds, while blocks come much more often
+void AdcManager::UpdateBlockTime() {
+  
+  unsigned long cycle_count = 0;
+  unsigned long cycles_since_trigger = 0;
+  portReadTriggerTime( adc_number_, &cycle_count, &cycles_since_trigger );
+  
+  if(cycle_count < last_cycle_count_)
+    cycle_count_high_ += 1ULL << 32;
+  last_cycle_count_ = cycle_count;
+  
+  const Timestamp now = cycle_count_high_ + cycle_count;
+  const Timestamp sequence_period = nominal_block_period_ / block_length_;
+  Timestamp trigger_time = now - cycles_since_trigger;
+  
+  if(block_time_valid_){
+    const Timestamp expected_time = block_time_ + nominal_block_period_;
+    
+    if( (trigger_time > expected_time) && (sequence_period > 0) ){
+      const Timestamp late_sequences = (trigger_time - expected_time + sequence_period / 2) / sequence_period;
+      if(late_sequences < (Timestamp) block_length_)
+        trigger_time -= late_sequences * sequence_period;
     }
+    
+    const Timestamp period = trigger_time - block_time_;
+    
+    if( (period + sequence_period / 2 < nominal_block_period_) || (period > nominal_block_period_ + sequence_period / 2) ){
+      timing_gaps_++;
+      block_period_ = nominal_block_period_;
+    }
+    else {
+      block_period_ = period;
+      if( (min_block_period_ == 0) || (period < min_block_period_) )
+        min_block_period_ = period;
+      if(period > max_block_period_)
+        max_block_period_ = period;
+    }
+  }
+  else {
+    block_period_ = nominal_block_period_;
+    block_time_valid_ = true;
+  }
+  
+  block_time_ = trigger_time;
+  timed_blocks_++;
+  
+  last_latency_ = static_cast<unsigned long>( now - trigger_time );
+  if(last_latency_ > max_latency_)
+    max_latency_ = last_latency_;
+}
+
+
+static unsigned long CyclesToNanoseconds( const Timestamp cycles, const unsigned long frequency ){
+  return (frequency == 0) ? 0 : static_cast<unsigned long>( cycles * 1000000000ULL / frequency );
+}
+
+
+void AdcManager::GetTimingStatistics( TimingStatistics* statistics ) {
+  const unsigned long frequency = portGetCycleFrequency();
+  
+  portMaskBlockInterrupt( adc_number_ );
+  statistics->blocks = timed_blocks_;
+  statistics->gaps = timing_gaps_;
+  const Timestamp min_period = min_block_period_;
+  const Timestamp max_period = max_block_period_;
+  const unsigned long last_latency = last_latency_;
+  const unsigned long max_latency = max_latency_;
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  statistics->nominal_period_ns = CyclesToNanoseconds( nominal_block_period_, frequency );
+  statistics->min_period_ns = CyclesToNanoseconds( min_period, frequency );
+  statistics->max_period_ns = CyclesToNanoseconds( max_period, frequency );
+  statistics->last_latency_ns = CyclesToNanoseconds( last_latency, frequency );
+  statistics->max_latency_ns = CyclesToNanoseconds( max_latency, frequency );
+}
+
+
+static ThresholdZone GetThresholdZone( const ThresholdWatch &watch, const AdcSample sample ){
+  if(sample < watch.low)
+    return kBelowThresholds;
+  if(sample > watch.high)
+    return kAboveThresholds;
+  return kInsideThresholds;
+}
+
+
+static bool ThresholdsValid( const AdcSample low_threshold, const AdcSample high_threshold, const ThresholdHandler handler ){
+  return (handler != nullptr) && (low_threshold <= high_threshold) && (high_threshold <= kMaxAdcValue);
+}
+
+
+  //hardware watchdog is switched off, while its settings are changed
+ReturnState AdcManager::SetAnalogWatchdog( const AdcChannel channel, const AdcSample low_threshold, const AdcSample high_threshold,
+                                           const ThresholdHandler handler, void* context ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  if( !ThresholdsValid( low_threshold, high_threshold, handler ) )
+    return kError;
+  
+  if( (channel != kNoChannel) && ((channel < kCh0) || (channel >= kChannelsAmount)) )
+    return kError;
+  
+  ClearAnalogWatchdog();
+  
+  portMaskBlockInterrupt( adc_number_ );
+  watchdog_ = { low_threshold, high_threshold, handler, context, kInsideThresholds };
+  watchdog_channel_ = channel;
+  watchdog_armed_ = true;
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  if( portSetAnalogWatchdog( adc_number_, channel, low_threshold, high_threshold ) != kOk ){
+    ClearAnalogWatchdog();
+    return kError;
   }
   
   return kOk;
 }
 
 
+ReturnState AdcManager::ClearAnalogWatchdog() {
+  
+  if(!initialised_)
+    return kError;
+  
+  portClearAnalogWatchdog( adc_number_ );
+  
+  portMaskBlockInterrupt( adc_number_ );
+  watchdog_ = {};
+  watchdog_channel_ = kNoChannel;
+  watchdog_armed_ = false;
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return kOk;
+}
+
+
+ReturnState AdcManager::SetChannelThresholds( const AdcChannel channel, const AdcSample low_threshold, const AdcSample high_threshold,
+                                              const ThresholdHandler handler, void* context ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  if( (channel < kCh0) || (channel >= kChannelsAmount) || !ThresholdsValid( low_threshold, high_threshold, handler ) )
+    return kError;
+  
+  portMaskBlockInterrupt( adc_number_ );
+  thresholds_[channel] = { low_threshold, high_threshold, handler, context, kInsideThresholds };
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return kOk;
+}
+
+
+ReturnState AdcManager::ClearChannelThresholds( const AdcChannel channel ) {
+  
+  if(!initialised_)
+    return kError;
+  
+  if( (channel < kCh0) || (channel >= kChannelsAmount) )
+    return kOk;
+  
+  portMaskBlockInterrupt( adc_number_ );
+  thresholds_[channel] = {};
+  portUnmaskBlockInterrupt( adc_number_ );
+  
+  return kOk;
+}
+
+
+  //Software threshold engine, called from block interrupt for each channel with thresholds
+void AdcManager::CheckThresholds( const AdcChannel channel, const ChannelSamples &samples ) {
+  
+  ThresholdWatch &watch = thresholds_[channel];
+  
+  for(int i = 0; i < samples.amount; i++){
+    const AdcSample sample = samples.first[i * samples.stride];
+    const ThresholdZone zone = GetThresholdZone( watch, sample );
+    
+    if(zone == watch.zone)
+      continue;
+    
+    watch.zone = zone;
+    
+    if(zone != kInsideThresholds)
+      watch.handler( watch.context, channel, (zone == kBelowThresholds) ? kBelowLowThreshold : kAboveHighThreshold, sample );
+  }
+}
+
+
+  //Watchdog, which has reported crossing, is armed again, when all watched samples of a block are within thresholds
+  //In dual mode hardware watchdog of master sees only even samples of sequence
+void AdcManager::RearmWatchdog( const AdcSample* half_start ) {
+  
+  if( (watchdog_.handler == nullptr) || watchdog_armed_ )
+    return;
+  
+  const int slot_step = (dual_mode_ == kIndependentMode) ? 1 : 2;
+  
+  for(int slot = 0; slot < sequence_samples_; slot += slot_step){
+    const AdcChannel channel = scan_order_[slot];
+    
+    if( (channel == kNoChannel) || ((watchdog_channel_ != kNoChannel) && (channel != watchdog_channel_)) )
+      continue;
+    
+    const ChannelSamples samples = GetBlockSamples( half_start, slot );
+    for(int i = 0; i < samples.amount; i++){
+      if(GetThresholdZone( watchdog_, samples.first[i * samples.stride] ) != kInsideThresholds)
+        return;
+    }
+  }
+  
+  watchdog_armed_ = true;
+  portArmAnalogWatchdog( adc_number_ );
+}
+
+
+  //Called from ADC interrupt, watchdog interrupt is already disabled by port
+void AdcManager::ReportWatchdogEvent( const AdcChannel channel, const AdcSample sample ) {
+  
+  if(watchdog_.handler == nullptr)
+    return;
+  
+  watchdog_armed_ = false;
+  
+  const ThresholdCrossing crossing = (sample > watchdog_.high) ? kAboveHighThreshold : kBelowLowThreshold;
+  watchdog_.handler( watchdog_.context, channel, crossing, sample );
+}
+
+
+  //Called from block interrupt: reference is converted as injected channel, result is collected at next block,
+  //so that interrupt never waits for conversion
+  //It is skipped, if injected conversion would not fit into sample period together with scan list
+void AdcManager::UpdateSupplyEstimate() {
+  
+  if(dual_mode_ == kFastInterleavedMode)
+    return;
+  
+  if(reference_pending_){
+    AdcSample reference = 0;
+    if(portReadInjected( adc_number_, &reference, 1 ) != kOk)
+      return;
+    reference_pending_ = false;
+    FilterReference( reference );
+  }
+  
+  reference_block_counter_++;
+  if(reference_block_counter_ < reference_period_blocks_)
+    return;
+  reference_block_counter_ = 0;
+  
+  AdcTiming reference_timing = timing_;
+  reference_timing.sample_time[kReferenceChannel] = kReferenceSampleTime;
+  
+  if( PlanSampleRate( reference_timing, &kReferenceChannel, 1, 0 ) < sample_rate_ )
+    return;
+  
+  if( portStartInjected( adc_number_, &kReferenceChannel, &kReferenceSampleTime, 1 ) == kOk )
+    reference_pending_ = true;
+}
+
+
+void AdcManager::DeliverBlock( const BufferHalf completed_half ) {
+  
+  const int stride = sequence_samples_;
+  
+  if(stride == 0)
+    return;
+  
+  //staged scan list goes to hardware before any other work, while the next trigger has not yet come
+  AdcChannel next_sequence[kChannelsAmount];
+  int next_samples_amount = 0;
+  const bool scan_list_switched = (completed_half == kSecondHalf) && SwitchToRequestedScanList(next_sequence, &next_samples_amount);
+  
+  UpdateBlockTime();
+  UpdateCalibration();
+  
+  const AdcSample* half_start = buffer_ + completed_half * block_length_ * stride;
+  
+  for(int slot = 0; slot < sequence_samples_; slot++){
+    const AdcChannel channel = scan_order_[slot];
+    if( (channel == kNoChannel) || (channel_slot_[channel] != slot) )
+      continue;
+    if(oversampling_order_[channel] > 0)
+      AccumulateOversampling( channel, GetBlockSamples( half_start, slot ) );
+    if(thresholds_[channel].handler != nullptr)
+      CheckThresholds( channel, GetBlockSamples( half_start, slot ) );
+  }
+  
+  RearmWatchdog( half_start );
+  
+  for(auto &subscription : subscriptions_){
+    int index = GetChannelIndex( subscription.channel );
+    
+    if(index == kInvalidIndex)
+      continue;
+    
+    subscription.handler( subscription.context, GetBlockSamples( half_start, index ) );
+  }
+  
+  UpdateSupplyEstimate();
+  
+  if(completed_half == kFirstHalf)
+    scan_list_changed_ = false;
+  else if(scan_list_switched)
+    CompleteScanListSwitch(next_sequence, next_samples_amount);
+}
+
+
 }               //namespace stm32adc
\ No newline at end of file
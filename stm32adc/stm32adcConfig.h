@@ -3,6 +3,40 @@
 
 #define adc_configDEFAULT_MAX_SIMULTANEOUSLY_SCANNED_CHANNELS         15
 
+  //rate (Hz) at which trigger timer starts conversion of the whole scan list
+#define adc_configDEFAULT_SAMPLE_RATE                                 3000
+  //amount of scan sequences in one block (half of DMA ping-pong buffer) delivered to subscribers
+#define adc_configDEFAULT_BLOCK_LENGTH                                32
+
+  //clock ADC prescaler is fed with (PCLK2)
+#define adc_configADC_INPUT_CLOCK                                     72000000UL
+  //ADC clock divider and sampling time of channels, unless changed by SetAdcPrescaler(), SetChannelSampleTime()
+  //ADC clock must not exceed 14 MHz
+#define adc_configDEFAULT_ADC_PRESCALER                               kAdcPrescaler8
+#define adc_configDEFAULT_SAMPLE_TIME                                 kSampleTime239_5
+
+  //clock of the timer used as ADC trigger source (TIM3 on APB1, x2 multiplier)
+#define adc_configTRIGGER_TIMER_CLOCK                                 72000000UL
+
+  //NVIC priority of ADC DMA interrupt. Must be numerically not lower than
+  //configMAX_SYSCALL_INTERRUPT_PRIORITY level, if subscribers use FreeRTOS critical sections
+#define adc_configIRQ_PRIORITY                                        12
+
+  //highest oversampling order: 4^order samples per value, (12 + order) bits of resolution
+#define adc_configMAX_OVERSAMPLING_ORDER                              4
+
+  //supply voltage VDDA is estimated by internal reference VREFINT (ch17), converted in background while scan list runs
+  //VREFINT of stm32f103 is not calibrated in factory: 1.16..1.24V, typically 1.20V (set measured value for better accuracy)
+#define adc_configVREFINT_MILLIVOLTS                                  1200
+  //VDDA, which full scale of samples is referred to by GetSupplyCorrection()
+#define adc_configNOMINAL_VDDA_MILLIVOLTS                             3300
+  //period of VREFINT conversions and weight of each new one in VDDA estimate (1 / 2^shift)
+#define adc_configSUPPLY_UPDATE_PERIOD_MS                             100
+#define adc_configSUPPLY_FILTER_SHIFT                                 3
+
+  //ADC is calibrated at initialisation and then every period (0: never again), in the gap between two scan sequences
+#define adc_configRECALIBRATION_PERIOD_MS                             60000
+
 #define adc_configUSE_CH0
 #define adc_configUSE_CH1
 #define adc_configUSE_CH2
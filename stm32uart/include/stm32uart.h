@@ -32,6 +32,9 @@ typedef std::string                                     String;
 typedef int                                             BufferSize;
 typedef unsigned char                                   BufferElement;
 
+  //called from interrupt context
+typedef void (*UartEventHandler)(const UartHardwareNumber uart_number);
+
 struct UartSettings {
   Speed         speed                   = uart_configDEFAULT_SPEED;
   StopBits      stop_bits               = kStopBitsOne;
@@ -56,6 +59,7 @@ public:
 class MessageBox;
 class CircularBuffer;
 class UartManager;
+class TextFormatter;
 
 
 const UartSettings kDefaultSettings;
@@ -74,11 +78,29 @@ const UartSettings kDefaultSettings;
 ReturnState InitUart(const UartHardwareNumber uart_number, const UartSettings &uart_settings);
 
   //Adds -message- to outbox of uart -uart_number-
+  //Transmission starts at once if line is idle. Further chunks of outbox are sent 
+  //from dma transfer complete interrupt, until outbox is empty
   //            Possible returns:
   //    kOk                     : message successfuly added to outbox
   //    kMessageBoxOverfill     : message is not added due to exceeded messages amount in outbox
   //    kUartNotInitialised     : requested uart does not exist
-ReturnState SendMessage(const UartHardwareNumber uart_number, const String message);
+ReturnState SendMessage(const UartHardwareNumber uart_number, const String &message);
+  //Same as SendMessage() above: text is copied to outbox directly, without temporary string
+ReturnState SendMessage(const UartHardwareNumber uart_number, const char *message);
+ReturnState SendMessage(const UartHardwareNumber uart_number, const char *message, const BufferSize length);
+  //Sends text, built by TextFormatter (see "stm32uart_format.h")
+ReturnState SendMessage(const UartHardwareNumber uart_number, const TextFormatter &message);
+
+  //Same as SendMessage(), to be called from interrupt, which may preempt tasks and uart interrupts
+  //-message- of -length- bytes (up to uart_configISR_MESSAGE_LENGTH) is copied without memory allocation 
+  //to one of uart_configISR_MESSAGE_SLOTS slots, and tx interrupt is pended: it moves message to outbox
+  //and starts transmission, if line is idle. One interrupt priority level should send this way
+  //            Possible returns:
+  //    kOk                     : message is copied, it will be sent after pending ones
+  //    kMessageBoxOverfill     : message is not added: all slots are occupied
+  //    kError                  : message is too long
+  //    kUartNotInitialised     : requested uart does not exist
+ReturnState SendMessageFromIsr(const UartHardwareNumber uart_number, const char *message, const BufferSize length);
 
   //Checks inbox of uart -uart_number-
   //If inbox empty, -*rx_message- sets equal to nullptr
@@ -90,19 +112,22 @@ ReturnState SendMessage(const UartHardwareNumber uart_number, const String messa
   //    kUartNotInitialised     : requested uart does not exist
 ReturnState GetPendingMessage(const UartHardwareNumber uart_number, String *rx_message);
 
-  //To be executed as frequently as deemed reasonable taking into account uart speed, buffers' sizes and desired response time
+  //Moves received data from rx buffer to inbox
+  //To be executed after rx event (see SetRxEventHandler()), or as frequently as deemed reasonable
+  //taking into account uart speed, buffers' sizes and desired response time
   //            Possible returns:
   //    kOk                     : executed normally
   //    kUartNotInitialised     : requested uart does not exist
   //    kError                  : other error
-ReturnState TxRoutine(const UartHardwareNumber uart_number);
+ReturnState RxRoutine(const UartHardwareNumber uart_number);
 
-  //To be executed as frequently as deemed reasonable taking into account uart speed, buffers' sizes and desired response time
+  //Sets -handler- to be called from interrupt when received data is waiting in rx buffer:
+  //line became idle after a burst, or a half of rx buffer has been filled.
+  //Handler is supposed to wake the task, which executes RxRoutine()
   //            Possible returns:
-  //    kOk                     : executed normally
+  //    kOk                     : handler is set
   //    kUartNotInitialised     : requested uart does not exist
-  //    kError                  : other error
-ReturnState RxRoutine(const UartHardwareNumber uart_number);
+ReturnState SetRxEventHandler(const UartHardwareNumber uart_number, const UartEventHandler handler);
   
 }       //namespace stm32uart
 
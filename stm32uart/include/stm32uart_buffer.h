@@ -6,6 +6,21 @@
 
 namespace stm32uart{
   
+  //contiguous region of buffer memory
+struct BufferSpan{
+  BufferElement* start;
+  BufferSize length;
+};
+
+  //region of circular buffer, split in two spans at wrap point
+  //-second- is empty, unless region wraps
+struct BufferSpans{
+  BufferSpan first;
+  BufferSpan second;
+  
+  BufferSize Length() const { return first.length + second.length; }
+};
+  
 class CircularBuffer{
 private:
   BufferSize allocated_size_;
@@ -35,6 +50,15 @@ public:
   ReturnState PopFront(BufferElement *element);
   ReturnState Reset();
   
+    //Data between tail and head, to be processed in place and then released with Consume()
+  BufferSpans ReadableSpans() const;
+    //Free space after head, to be filled in place and then published with Commit()
+    //One element is always kept free, so that full buffer is not confused with empty one
+  BufferSpans WritableSpans() const;
+  void Consume(const BufferSize amount);
+  void Commit(const BufferSize amount);
+  
+  ReturnState PushChunk(const BufferElement* data, const BufferSize length);
   ReturnState PushChunk(const String &new_chunk);
   
   ReturnState GetData(BufferElement* data);
@@ -0,0 +1,54 @@
+#ifndef STM32UART_FORMAT_H
+#define STM32UART_FORMAT_H
+
+#include "stm32uartConfig.h"
+#include "stm32uart.h"
+
+namespace stm32uart{
+
+  //Builds message text in memory, supplied by caller (e.g. local array), so no heap is used
+  //Numbers are written with integer arithmetic only; fixed point values are shown with given amount of decimals
+  //Text, which does not fit, is cut off, and IsTruncated() is set
+  //Formatter touches nothing but its buffer, so it may be used in interrupt
+class TextFormatter{
+private:
+  char *buffer_;
+  BufferSize capacity_;
+  BufferSize length_;
+  bool truncated_;
+
+  TextFormatter(const TextFormatter&) = delete;
+  TextFormatter& operator=(const TextFormatter&) = delete;
+
+public:
+  TextFormatter(char *buffer, const BufferSize capacity);
+
+  TextFormatter& Text(const char *text);
+  TextFormatter& Text(const char *text, const BufferSize length);
+  TextFormatter& Symbol(const char symbol);
+  TextFormatter& Unsigned(unsigned long long value);
+  TextFormatter& Signed(const long long value);
+    //-value- has -fraction_digits- decimal digits after point (e.g. microvolts as volts: 6),
+    //-shown_digits- of them are written, rounded to nearest
+  TextFormatter& Fixed(const long long value, const int fraction_digits, const int shown_digits);
+
+  void Clear();
+
+  const char* Data() const;
+  BufferSize Length() const;
+  bool IsTruncated() const;
+};
+
+
+  //Formatter together with its buffer of -kCapacity- bytes, to be placed on stack
+template <BufferSize kCapacity>
+class TextBuffer : public TextFormatter{
+private:
+  char storage_[kCapacity];
+public:
+  TextBuffer() : TextFormatter(storage_, kCapacity) {}
+};
+
+}               //namespace stm32uart
+
+#endif          //STM32UART_FORMAT_H
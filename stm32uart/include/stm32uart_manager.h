@@ -13,9 +13,18 @@ private:
   MessageBox inbox_;             
   MessageBox outbox_;                                        
   
+    //messages from interrupts: single producer (interrupt) and single consumer (tx interrupt) ring of fixed slots
+  BufferElement isr_messages_[uart_configISR_MESSAGE_SLOTS][uart_configISR_MESSAGE_LENGTH];
+  BufferSize isr_message_length_[uart_configISR_MESSAGE_SLOTS];
+  volatile int isr_write_index_;
+  volatile int isr_read_index_;
+  
   CircularBuffer* rx_buffer_;
   CircularBuffer* tx_buffer_;
   
+  UartEventHandler rx_event_handler_;
+  
+  bool tx_in_progress_;
   bool valid_;
   
   UartManager();
@@ -27,13 +36,27 @@ public:
   
   bool OutboxEmpty();
   
-  ReturnState FillTxBuffer();
+  bool TxInProgress() const;
+  void SetTxInProgress(const bool tx_in_progress);
+  
+    //Moves next chunk of outbox to tx buffer, returns its length (zero if outbox is empty)
+    //Called from tx complete interrupt, or with this interrupt masked
+  BufferSize FillTxBuffer();
   ReturnState TakeDataFromRxBuffer();
   
   CircularBuffer* GetRxBufferAddress();
   CircularBuffer* GetTxBufferAddress();
      
-  ReturnState AddMessageToOutbox(const String message);
+  void SetRxEventHandler(const UartEventHandler handler);
+  UartEventHandler GetRxEventHandler() const;
+     
+    //end of line symbol is appended to -message-
+  ReturnState AddMessageToOutbox(const char *message, const BufferSize length);
+  
+    //Called from interrupt, copies -message- to free slot
+  ReturnState AddMessageFromIsr(const char *message, const BufferSize length);
+    //Called from tx complete interrupt, or with this interrupt masked
+  void MoveIsrMessagesToOutbox();
   ReturnState TakeMessageFromInbox(String *message);
 };
 
@@ -2,36 +2,76 @@
 #define STM32UART_MESSAGES_H
 
 namespace stm32uart{
-  
+
+  //Messages are stored one after another in preallocated circular byte arena,
+  //arena size is max_messages_stored * max_message_length.
+  //Position and length of each message is kept in circular index of records.
+  //Neither storing nor taking messages allocates memory.
 class MessageBox{
 private:
-  std::list<String> messages_;
+  struct MessageRecord{
+    BufferSize offset;
+    BufferSize length;
+  };
+
+  BufferElement *arena_;
+  BufferSize arena_size_;
+  BufferSize arena_used_;
+  BufferSize write_index_;
+
+  MessageRecord *records_;
+  int max_messages_;
+  int first_record_;
+  int records_amount_;
+    //bytes of the first message, already handed out by GetNextChunk()
+  BufferSize front_offset_;
+
   String temp_message_;
-  int max_messages_;    
   int max_message_length_;
   String eol_symbol_;
   bool overfill_flag_;
-  
-  
+  bool valid_;
+
+  MessageBox(const MessageBox&) = delete;
+  MessageBox& operator=(const MessageBox&) = delete;
+
+  void CopyToArena(const BufferSize index, const char *data, const BufferSize length);
+  void CopyFromArena(const BufferSize index, BufferElement *destination, const BufferSize length) const;
+  void DropFirstRecord();
+  ReturnState PutRecord(const char *data, const BufferSize length, const char *suffix, const BufferSize suffix_length);
+
 public:
   MessageBox();
   MessageBox(const UartSettings &uart_settings);
   ~MessageBox();
 
+  bool IsValid() const;
+
   bool Empty();
   int Size();
-  
+
   bool ReadOverfillFlag();
   void ClearOverfillFlag();
-  
-  ReturnState DropRawString(String &new_string);
-  
+
+    //Splits raw received data into messages by end of line symbol
+    //Data is scanned in place, unfinished message is kept until next call
+  ReturnState DropRawData(const BufferElement *data, const BufferSize length);
+
+    //If there is no room for new message, the oldest messages are dropped
   ReturnState Put(const String &new_message);
+    //Same as Put(), end of line symbol is appended to the message
+  ReturnState PutLine(const String &text);
+  ReturnState PutLine(const char *text, const BufferSize length);
+
+    //-*message- does not reallocate, if its capacity is enough for the message
   ReturnState GetNext(String *message);
   ReturnState GetNextElement(BufferElement *element);
-  bool GetNextChunk(const BufferSize chunk_length, String *message);
+
+    //Copies up to -chunk_length- bytes of pending messages to -destination-, returns amount copied
+    //May be called from interrupt, provided that other methods are called with this interrupt masked
+  BufferSize GetNextChunk(BufferElement *destination, const BufferSize chunk_length);
 };
 
 }               //namespace stm32uart
 
-#endif          //STM32UART_MESSAGES_H
\ No newline at end of file
+#endif          //STM32UART_MESSAGES_H
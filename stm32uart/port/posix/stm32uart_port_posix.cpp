@@ -0,0 +1,231 @@
+//file stm32uart_port_posix.cpp
+//port for host simulation (Linux, FreeRTOS POSIX port)
+//Replaces stm32uart_port.cpp in host build. Uart is bridged to pseudo terminal,
+//its name is printed at initialisation, so any terminal program can be connected to it.
+//Line speed is modeled: bytes are moved not faster than uart_settings.speed allows.
+//Rx and tx "interrupts" are raised from portServiceSimulation(), which application calls
+//from interrupt-like context (FreeRTOS tick hook)
+
+#include <set>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "stm32uart.h"
+#include "stm32uart_buffer.h"
+
+namespace stm32uart {
+
+extern void HandleRxEvent(const UartHardwareNumber uart_number);
+extern void HandleTxComplete(const UartHardwareNumber uart_number);
+extern void HandleTxRequest(const UartHardwareNumber uart_number);
+
+static const std::set<UartHardwareNumber> available_uarts = {kUart1, kUart2, kUart3};
+
+  //bits per byte on the line: start + 8 data + stop
+static const long kBitsPerByte = 10;
+
+  //state of simulated uart together with its DMA channels
+struct SimulatedUart {
+  int                   master_fd;
+  int                   slave_fd;
+  long                  bytes_per_second;
+  timespec              last_service;
+  long long             rx_credit_ns;
+  long long             tx_credit_ns;
+
+  BufferElement*        rx_buffer;
+  BufferSize            rx_buffer_size;
+  BufferSize            rx_index;
+
+  const BufferElement*  tx_buffer;
+  BufferSize            tx_length;
+  BufferSize            tx_sent;
+  bool                  tx_masked;
+  bool                  tx_complete_pending;
+  bool                  tx_request_pending;
+};
+
+static SimulatedUart simulated_uart[kUart5 + 1] = {};
+
+static bool IsUartActive(const SimulatedUart &uart){
+  return uart.master_fd > 0;
+}
+
+static long long UpdateCredit(long long *credit_ns, const long long elapsed_ns, const BufferSize max_bytes, const long bytes_per_second){
+  const long long byte_time_ns = 1000000000LL / bytes_per_second;
+  *credit_ns += elapsed_ns;
+  if(*credit_ns > max_bytes * byte_time_ns)
+    *credit_ns = max_bytes * byte_time_ns;
+  return *credit_ns / byte_time_ns;
+}
+
+static ReturnState portIsUartAvailable(const UartHardwareNumber uart_number){
+  if(available_uarts.find(uart_number) != available_uarts.end())
+    return kOk;
+  return kError;
+}
+
+ReturnState portInitUart(const UartHardwareNumber uart_number,
+                         const UartSettings &uart_settings,
+                         const CircularBuffer *rx_buffer,
+                         const CircularBuffer *tx_buffer){
+
+  if(portIsUartAvailable(uart_number) == kError)
+    return kError;
+
+  if(uart_settings.speed <= 0)
+    return kError;
+
+  SimulatedUart &uart = simulated_uart[uart_number];
+
+  if(IsUartActive(uart)){
+    close(uart.slave_fd);
+    close(uart.master_fd);
+  }
+  uart = {};
+
+  int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(master_fd < 0)
+    return kError;
+
+  if( (grantpt(master_fd) != 0) || (unlockpt(master_fd) != 0) ){
+    close(master_fd);
+    return kError;
+  }
+
+    //slave side is kept open, so that master does not see hangup while no terminal is connected
+  int slave_fd = open(ptsname(master_fd), O_RDWR | O_NOCTTY);
+  if(slave_fd < 0){
+    close(master_fd);
+    return kError;
+  }
+
+  termios raw_mode;
+  tcgetattr(slave_fd, &raw_mode);
+  cfmakeraw(&raw_mode);
+  tcsetattr(slave_fd, TCSANOW, &raw_mode);
+
+  fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+
+  uart.master_fd = master_fd;
+  uart.slave_fd = slave_fd;
+  uart.bytes_per_second = uart_settings.speed / kBitsPerByte;
+  clock_gettime(CLOCK_MONOTONIC, &uart.last_service);
+
+  uart.rx_buffer = rx_buffer->StartAddress();
+  uart.rx_buffer_size = rx_buffer->AllocatedSize();
+  uart.tx_buffer = tx_buffer->StartAddress();
+
+  std::printf("stm32uart: uart%d is connected to %s\n", uart_number + 1, ptsname(master_fd));
+  std::fflush(stdout);
+
+  return kOk;
+}
+
+
+ReturnState portSetupTx(const UartHardwareNumber uart_number, const BufferSize length){
+  if(portIsUartAvailable(uart_number) == kError)
+    return kError;
+
+  SimulatedUart &uart = simulated_uart[uart_number];
+  uart.tx_length = length;
+  uart.tx_sent = 0;
+  return kOk;
+}
+
+
+void portMaskTxInterrupt(const UartHardwareNumber uart_number){
+  simulated_uart[uart_number].tx_masked = true;
+}
+
+
+void portUnmaskTxInterrupt(const UartHardwareNumber uart_number){
+  simulated_uart[uart_number].tx_masked = false;
+}
+
+
+  //as pended interrupt on target, request is served by portServiceSimulation(), when tx interrupt is not masked
+void portRequestTxInterrupt(const UartHardwareNumber uart_number){
+  simulated_uart[uart_number].tx_request_pending = true;
+}
+
+
+  //imitates DMA CNDTR: amount of transfers left till the end of rx buffer
+int portGetCurrentRxBufferIndex(const UartHardwareNumber uart_number){
+  const SimulatedUart &uart = simulated_uart[uart_number];
+  return uart.rx_buffer_size - uart.rx_index;
+}
+
+
+  //Moves bytes between pseudo terminal and buffers at line speed, raises rx and tx events
+void portServiceSimulation(){
+
+  for(int uart_index = kUart1; uart_index <= kUart5; uart_index++){
+    SimulatedUart &uart = simulated_uart[uart_index];
+    const UartHardwareNumber uart_number = static_cast<UartHardwareNumber>(uart_index);
+
+    if(!IsUartActive(uart))
+      continue;
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long long elapsed_ns = (now.tv_sec - uart.last_service.tv_sec) * 1000000000LL
+                                  + (now.tv_nsec - uart.last_service.tv_nsec);
+    uart.last_service = now;
+
+      //receiver: circular DMA into rx buffer, event on each received burst (idle line)
+    long long rx_allowed = UpdateCredit(&uart.rx_credit_ns, elapsed_ns, uart.rx_buffer_size, uart.bytes_per_second);
+    BufferSize received_total = 0;
+
+    while(rx_allowed > 0){
+      BufferSize space_till_wrap = uart.rx_buffer_size - uart.rx_index;
+      BufferSize to_read = (rx_allowed < space_till_wrap) ? rx_allowed : space_till_wrap;
+
+      ssize_t received = read(uart.master_fd, uart.rx_buffer + uart.rx_index, to_read);
+      if(received <= 0)
+        break;
+
+      uart.rx_index = (uart.rx_index + received) % uart.rx_buffer_size;
+      rx_allowed -= received;
+      received_total += received;
+    }
+    uart.rx_credit_ns -= received_total * (1000000000LL / uart.bytes_per_second);
+
+    if(received_total > 0)
+      HandleRxEvent(uart_number);
+
+      //transmitter: DMA from tx buffer, completion event is postponed while it is masked
+    if(uart.tx_sent < uart.tx_length){
+      long long tx_allowed = UpdateCredit(&uart.tx_credit_ns, elapsed_ns, uart.tx_length, uart.bytes_per_second);
+      BufferSize to_write = uart.tx_length - uart.tx_sent;
+      if(to_write > tx_allowed)
+        to_write = tx_allowed;
+
+      ssize_t written = (to_write > 0) ? write(uart.master_fd, uart.tx_buffer + uart.tx_sent, to_write) : 0;
+      if(written > 0){
+        uart.tx_sent += written;
+        uart.tx_credit_ns -= written * (1000000000LL / uart.bytes_per_second);
+        if(uart.tx_sent == uart.tx_length)
+          uart.tx_complete_pending = true;
+      }
+    }
+
+    if(uart.tx_complete_pending && (!uart.tx_masked)){
+      uart.tx_complete_pending = false;
+      uart.tx_request_pending = false;
+      HandleTxComplete(uart_number);
+    }
+
+    if(uart.tx_request_pending && (!uart.tx_masked)){
+      uart.tx_request_pending = false;
+      HandleTxRequest(uart_number);
+    }
+  }
+}
+
+}               //namespace stm32uart
@@ -6,6 +6,10 @@
 
 namespace stm32uart {
   
+extern void HandleRxEvent(const UartHardwareNumber uart_number);
+extern void HandleTxComplete(const UartHardwareNumber uart_number);
+extern void HandleTxRequest(const UartHardwareNumber uart_number);
+  
 static const std::set<UartHardwareNumber> available_uarts = {kUart1, kUart2, kUart3};
 
 
@@ -68,20 +72,30 @@ static ReturnState portInitUart1(const UartSettings &uart_settings, const Circul
   
   //memory address increment
   //direction: memory -> peripheral
-  DMA1_Channel4->CCR = DMA_CCR_MINC | DMA_CCR_DIR;  
+  //interrupt on complete transfer, next chunk is started from it
+  DMA1_Channel4->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE;  
   
   //mempry address increment
   //circular mode
-  DMA1_Channel5->CCR = DMA_CCR_MINC | DMA_CCR_CIRC;  
+  //interrupts on filled half and on filled whole buffer
+  DMA1_Channel5->CCR = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE;  
   
   //Uart -> DMA transfer enabled
   DMA1_Channel5->CCR |= DMA_CCR_EN; 
-  //DMA -> Uart transfer (Tx) will be enabled later, when needed
+  //DMA -> Uart transfer (Tx) will be enabled later, for each chunk
  
   //Enabled work with DMA in UART
   USART1->CR3 |= USART_CR3_DMAR | USART_CR3_DMAT;   
-  //Enable UART Rx (Tx will be allowed later, when needed)
-  USART1->CR1 |= USART_CR1_RE;  
+  //Enable UART Rx and Tx
+  //Idle line interrupt marks the end of a burst
+  USART1->CR1 |= USART_CR1_RE | USART_CR1_TE | USART_CR1_IDLEIE;  
+  
+  NVIC_SetPriority(USART1_IRQn, uart_configIRQ_PRIORITY);
+  NVIC_SetPriority(DMA1_Channel4_IRQn, uart_configIRQ_PRIORITY);
+  NVIC_SetPriority(DMA1_Channel5_IRQn, uart_configIRQ_PRIORITY);
+  NVIC_EnableIRQ(USART1_IRQn);
+  NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+  NVIC_EnableIRQ(DMA1_Channel5_IRQn);
   
   return kOk;
 }
@@ -132,15 +146,16 @@ ReturnState portInitUart(const UartHardwareNumber uart_number,
 }
 
 
-ReturnState portStopTx(const UartHardwareNumber uart_number){
+ReturnState portSetupTx(const UartHardwareNumber uart_number, const BufferSize length){
   //choose correct function
   //only uarts, enabled in config file, are available
   switch (uart_number){
     
 #ifdef uart_configENABLE_UART1
   case kUart1:
-      //Disable UART Tx
-    USART1->CR1 &= ~USART_CR1_TE; 
+    DMA1_Channel4->CCR &= ~DMA_CCR_EN; 
+    DMA1_Channel4->CNDTR = length;
+    DMA1_Channel4->CCR |= DMA_CCR_EN; 
     break;
 #endif  //uart_configENABLE_UART1
     
@@ -157,96 +172,46 @@ ReturnState portStopTx(const UartHardwareNumber uart_number){
   default:
     return kError;
   }  
+  
   return kOk;
 }
 
 
-BufferSize portTxBytesToSend(const UartHardwareNumber uart_number){
-  //choose correct function
-  //only uarts, enabled in config file, are available
+static IRQn_Type GetTxIrq(const UartHardwareNumber uart_number){
   switch (uart_number){
     
 #ifdef uart_configENABLE_UART1
   case kUart1:
-    return DMA1_Channel4->CNDTR;
+    return DMA1_Channel4_IRQn;
 #endif  //uart_configENABLE_UART1
     
-#ifdef uart_configENABLE_UART2   
-  case kUart2:
-    break;
-#endif  //uart_configENABLE_UART2
-    
-#ifdef uart_configENABLE_UART3
-  case kUart3:
-    break;
-#endif  //uart_configENABLE_UART3
-    
   default:
-    return 0;
+    return NonMaskableInt_IRQn;
   }  
 }
 
 
-ReturnState portSetupTx(const UartHardwareNumber uart_number, const BufferSize length){
-  //choose correct function
-  //only uarts, enabled in config file, are available
-  switch (uart_number){
-    
-#ifdef uart_configENABLE_UART1
-  case kUart1:
-    DMA1_Channel4->CCR &= ~DMA_CCR_EN; 
-    DMA1_Channel4->CNDTR = length;
-    DMA1_Channel4->CCR |= DMA_CCR_EN; 
-    break;
-#endif  //uart_configENABLE_UART1
-    
-#ifdef uart_configENABLE_UART2   
-  case kUart2:
-    break;
-#endif  //uart_configENABLE_UART2
-    
-#ifdef uart_configENABLE_UART3
-  case kUart3:
-    break;
-#endif  //uart_configENABLE_UART3
-    
-  default:
-    return kError;
-  }  
-  
-  return kOk;
+  //task side of outbox is protected from tx complete interrupt by masking it
+void portMaskTxInterrupt(const UartHardwareNumber uart_number){
+  IRQn_Type irq = GetTxIrq(uart_number);
+  if(irq != NonMaskableInt_IRQn)
+    NVIC_DisableIRQ(irq);
 }
 
 
-ReturnState portResumeTx(const UartHardwareNumber uart_number){
-  //choose correct function
-  //only uarts, enabled in config file, are available
-  switch (uart_number){
-    
-#ifdef uart_configENABLE_UART1
-  case kUart1:
-    //Enable UART Tx
-    
-    USART1->CR1 |= USART_CR1_TE; 
-    break;
-#endif  //uart_configENABLE_UART1
-    
-#ifdef uart_configENABLE_UART2   
-  case kUart2:
-    break;
-#endif  //uart_configENABLE_UART2
-    
-#ifdef uart_configENABLE_UART3
-  case kUart3:
-    break;
-#endif  //uart_configENABLE_UART3
-    
-  default:
-    return kError;
-  }  
-  
-  return kOk;
-}  
+void portUnmaskTxInterrupt(const UartHardwareNumber uart_number){
+  IRQn_Type irq = GetTxIrq(uart_number);
+  if(irq != NonMaskableInt_IRQn)
+    NVIC_EnableIRQ(irq);
+}
+
+
+  //tx interrupt is entered without transfer complete flag, see DMA1_Channel4_IRQHandler()
+void portRequestTxInterrupt(const UartHardwareNumber uart_number){
+  IRQn_Type irq = GetTxIrq(uart_number);
+  if(irq != NonMaskableInt_IRQn)
+    NVIC_SetPendingIRQ(irq);
+}
 
 
 int portGetCurrentRxBufferIndex(const UartHardwareNumber uart_number){
@@ -278,21 +243,31 @@ int portGetCurrentRxBufferIndex(const UartHardwareNumber uart_number){
 }               //namespace stm32uart
 
 
+#ifdef uart_configENABLE_UART1
 
+extern "C" void USART1_IRQHandler(void){
+  if(USART1->SR & USART_SR_IDLE){
+    //IDLE flag is cleared by reading SR followed by reading DR
+    (void) USART1->DR;
+    stm32uart::HandleRxEvent(stm32uart::kUart1);
+  }
+}
 
+extern "C" void DMA1_Channel4_IRQHandler(void){
+  if(DMA1->ISR & DMA_ISR_TCIF4){
+    DMA1->IFCR = DMA_IFCR_CTCIF4;
+    stm32uart::HandleTxComplete(stm32uart::kUart1);
+  }
+  else {
+    stm32uart::HandleTxRequest(stm32uart::kUart1);      //pended by software
+  }
+}
 
+extern "C" void DMA1_Channel5_IRQHandler(void){
+  if(DMA1->ISR & (DMA_ISR_HTIF5 | DMA_ISR_TCIF5)){
+    DMA1->IFCR = DMA_IFCR_CHTIF5 | DMA_IFCR_CTCIF5;
+    stm32uart::HandleRxEvent(stm32uart::kUart1);
+  }
+}
 
-
-
-
-
-
-
-
-
-
-
- 
- 
-
-
+#endif  //uart_configENABLE_UART1
\ No newline at end of file
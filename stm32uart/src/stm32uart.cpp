@@ -1,8 +1,10 @@
 #include <map>
+#include <cstring>
 
 #include "stm32uartConfig.h"
 #include "stm32uart.h"
 #include "stm32uart_manager.h"
+#include "stm32uart_format.h"
 
 namespace stm32uart {
   
@@ -11,10 +13,10 @@ extern ReturnState portInitUart(const UartHardwareNumber uart_number,
                                 const CircularBuffer *rx_buffer, 
                                 const CircularBuffer *tx_buffer);
 
-extern ReturnState portStopTx(const UartHardwareNumber uart_number);
-extern BufferSize portTxBytesToSend(const UartHardwareNumber uart_number);
 extern ReturnState portSetupTx(const UartHardwareNumber uart_number, const BufferSize length);
-extern ReturnState portResumeTx(const UartHardwareNumber uart_number);
+extern void portMaskTxInterrupt(const UartHardwareNumber uart_number);
+extern void portUnmaskTxInterrupt(const UartHardwareNumber uart_number);
+extern void portRequestTxInterrupt(const UartHardwareNumber uart_number);
 extern BufferSize portGetCurrentRxBufferIndex(const UartHardwareNumber uart_number);
 
 unsigned long GeneralSettings::cpu_frequency_ = uart_configDEFAULT_CPU_FREQUENCY;
@@ -38,6 +40,22 @@ static UartManager* GetUartManager(const UartHardwareNumber uart_number){
   return &(active_uarts_it->second);
 }
 
+  //called from tx complete interrupt, or with this interrupt masked
+static void StartNextTxChunk(const UartHardwareNumber uart_number, UartManager* uart_manager){
+  
+  uart_manager->MoveIsrMessagesToOutbox();
+  
+  BufferSize chunk_length = uart_manager->FillTxBuffer();
+  
+  if(chunk_length == 0){
+    uart_manager->SetTxInProgress(false);
+    return;
+  }
+  
+  uart_manager->SetTxInProgress(true);
+  portSetupTx(uart_number, chunk_length);
+}
+
 ReturnState InitUart(const UartHardwareNumber uart_number, const UartSettings &uart_settings) {
   
   active_uarts.erase(uart_number);
@@ -59,14 +77,56 @@ ReturnState InitUart(const UartHardwareNumber uart_number, const UartSettings &u
 }
   
 
-ReturnState SendMessage(const UartHardwareNumber uart_number, const String message){
+ReturnState SendMessage(const UartHardwareNumber uart_number, const String &message){
+  return SendMessage(uart_number, message.data(), message.length());
+}
+
+
+ReturnState SendMessage(const UartHardwareNumber uart_number, const char *message){
+  return SendMessage(uart_number, message, std::strlen(message));
+}
+
+
+ReturnState SendMessage(const UartHardwareNumber uart_number, const TextFormatter &message){
+  return SendMessage(uart_number, message.Data(), message.Length());
+}
+
+
+ReturnState SendMessage(const UartHardwareNumber uart_number, const char *message, const BufferSize length){
+  
+  UartManager* uart_manager = GetUartManager(uart_number);
+  
+  if(uart_manager == nullptr)
+    return kUartNotInitialised;
+  
+  portMaskTxInterrupt(uart_number);
+  
+  ReturnState result = uart_manager->AddMessageToOutbox(message, length);  
+  
+    //if line is idle, start transmission here, otherwise the message is chained from tx complete interrupt
+  if(!uart_manager->TxInProgress())
+    StartNextTxChunk(uart_number, uart_manager);
+  
+  portUnmaskTxInterrupt(uart_number);
+  
+  return result;
+}
+
+
+ReturnState SendMessageFromIsr(const UartHardwareNumber uart_number, const char *message, const BufferSize length){
   
   UartManager* uart_manager = GetUartManager(uart_number);
   
   if(uart_manager == nullptr)
     return kUartNotInitialised;
   
-  return uart_manager->AddMessageToOutbox(message + uart_configDEFAULT_EOL_SYMBOL);  
+  ReturnState result = uart_manager->AddMessageFromIsr(message, length);
+  
+    //outbox is touched only by tx interrupt and by tasks, which mask it
+  if(result == kOk)
+    portRequestTxInterrupt(uart_number);
+  
+  return result;
 }
 
 
@@ -83,44 +143,67 @@ ReturnState GetPendingMessage(const UartHardwareNumber uart_number, String *rx_m
 }
   
 
-ReturnState TxRoutine(const UartHardwareNumber uart_number){
+ReturnState RxRoutine(const UartHardwareNumber uart_number){
   UartManager* uart_manager = GetUartManager(uart_number);
   
   if(uart_manager == nullptr)
     return kUartNotInitialised;
+ 
+  CircularBuffer* rx_buffer = uart_manager->GetRxBufferAddress();
   
-  if(uart_manager->OutboxEmpty())
-    return kNoPendingMessages;
+  rx_buffer->SetHeadIndex( rx_buffer->AllocatedSize() - portGetCurrentRxBufferIndex(uart_number) );
+    
+  return uart_manager->TakeDataFromRxBuffer();
+}
+
+
+ReturnState SetRxEventHandler(const UartHardwareNumber uart_number, const UartEventHandler handler){
+  UartManager* uart_manager = GetUartManager(uart_number);
   
-  portStopTx(uart_number);
+  if(uart_manager == nullptr)
+    return kUartNotInitialised;
   
-  BufferSize bytes_to_send = portTxBytesToSend(uart_number);
+  uart_manager->SetRxEventHandler(handler);
+  return kOk;
+}
+
+
+  //called by port from interrupt
+void HandleRxEvent(const UartHardwareNumber uart_number){
+  UartManager* uart_manager = GetUartManager(uart_number);
   
-  if(bytes_to_send == 0){
-    CircularBuffer* tx_buffer = uart_manager->GetTxBufferAddress();
-    tx_buffer->Reset();
-    uart_manager->FillTxBuffer();
-    portSetupTx(uart_number, tx_buffer->Length());
-  }
+  if(uart_manager == nullptr)
+    return;
   
-  portResumeTx(uart_number);
-
-  return kOk;
+  UartEventHandler handler = uart_manager->GetRxEventHandler();
+  
+  if(handler != nullptr)
+    handler(uart_number);
 }
 
 
+  //called by port from interrupt
+void HandleTxComplete(const UartHardwareNumber uart_number){
+  UartManager* uart_manager = GetUartManager(uart_number);
+  
+  if(uart_manager == nullptr)
+    return;
+  
+  StartNextTxChunk(uart_number, uart_manager);
+}
 
-ReturnState RxRoutine(const UartHardwareNumber uart_number){
+
+  //called by port from tx interrupt, pended by SendMessageFromIsr()
+void HandleTxRequest(const UartHardwareNumber uart_number){
   UartManager* uart_manager = GetUartManager(uart_number);
   
   if(uart_manager == nullptr)
-    return kUartNotInitialised;
- 
-  CircularBuffer* rx_buffer = uart_manager->GetRxBufferAddress();
+    return;
   
-  rx_buffer->SetHeadIndex( rx_buffer->AllocatedSize() - portGetCurrentRxBufferIndex(uart_number) );
-    
-  return uart_manager->TakeDataFromRxBuffer();
+  uart_manager->MoveIsrMessagesToOutbox();
+  
+  if(!uart_manager->TxInProgress())
+    StartNextTxChunk(uart_number, uart_manager);
 }
 
   /*
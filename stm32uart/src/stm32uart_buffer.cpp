@@ -1,5 +1,7 @@
 //file stm32uart_buffer.cpp
 
+#include <cstring>
+
 #include "stm32uart_buffer.h"
 
 namespace stm32uart{
@@ -114,27 +116,72 @@ ReturnState CircularBuffer::Reset(){
   return kOk;
 }
 
-ReturnState CircularBuffer::GetData(BufferElement* data){
-  for(int i = 0; i < Length(); i++){
-    data[i] = start_address_[tail_index_];
-    IncrementTailIndex(1);
+BufferSpans CircularBuffer::ReadableSpans() const{
+  BufferSpans spans = { {start_address_ + tail_index_, 0}, {start_address_, 0} };
+  
+  if(head_index_ >= tail_index_){
+    spans.first.length = head_index_ - tail_index_;
   }
-  return kOk;
+  else{
+    spans.first.length = allocated_size_ - tail_index_;
+    spans.second.length = head_index_;
+  }
+  return spans;
 }
 
-ReturnState CircularBuffer::PushChunk(const String &new_chunk){
+BufferSpans CircularBuffer::WritableSpans() const{
+  BufferSpans spans = { {start_address_ + head_index_, 0}, {start_address_, 0} };
   
-  if(new_chunk.length() > allocated_size_)
-    return kError;
+  BufferSize free_space = allocated_size_ - 1 - Length();
+  BufferSize space_before_wrap = allocated_size_ - head_index_;
   
-  for(BufferSize i = 0; i < new_chunk.length(); i++){
-    start_address_[i] = new_chunk[i];
+  if(free_space <= space_before_wrap){
+    spans.first.length = free_space;
+  }
+  else{
+    spans.first.length = space_before_wrap;
+    spans.second.length = free_space - space_before_wrap;
   }
+  return spans;
+}
+
+void CircularBuffer::Consume(const BufferSize amount){
+  IncrementTailIndex(amount);
+}
+
+void CircularBuffer::Commit(const BufferSize amount){
+  SetHeadIndex(head_index_ + amount);
+}
+
+ReturnState CircularBuffer::GetData(BufferElement* data){
+  BufferSpans spans = ReadableSpans();
+  
+  std::memcpy(data, spans.first.start, spans.first.length);
+  std::memcpy(data + spans.first.length, spans.second.start, spans.second.length);
+  
+  Consume(spans.Length());
+  return kOk;
+}
+
+ReturnState CircularBuffer::PushChunk(const BufferElement* data, const BufferSize length){
+  BufferSpans spans = WritableSpans();
   
-  IncrementHeadIndex(new_chunk.length());
+  if(length > spans.Length())
+    return kBufferOverfill;
+  
+  BufferSize first_length = (length < spans.first.length) ? length : spans.first.length;
+  
+  std::memcpy(spans.first.start, data, first_length);
+  std::memcpy(spans.second.start, data + first_length, length - first_length);
+  
+  Commit(length);
   return kOk;
 }
 
+ReturnState CircularBuffer::PushChunk(const String &new_chunk){
+  return PushChunk( reinterpret_cast<const BufferElement*>(new_chunk.data()), new_chunk.length() );
+}
+
 
 
 }//namespace stm32uart
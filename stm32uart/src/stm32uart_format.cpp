@@ -0,0 +1,119 @@
+//file stm32uart_format.cpp
+
+#include "stm32uart_format.h"
+
+namespace stm32uart{
+
+  //decimal digits of the largest unsigned long long
+constexpr int kMaxDecimalDigits = 20;
+
+static unsigned long long PowerOfTen(int exponent){
+  unsigned long long result = 1;
+  while(exponent-- > 0)
+    result *= 10;
+  return result;
+}
+
+
+TextFormatter::TextFormatter(char *buffer, const BufferSize capacity){
+  buffer_ = buffer;
+  capacity_ = (buffer == nullptr) ? 0 : capacity;
+  Clear();
+}
+
+
+void TextFormatter::Clear(){
+  length_ = 0;
+  truncated_ = false;
+}
+
+
+TextFormatter& TextFormatter::Symbol(const char symbol){
+  if(length_ < capacity_)
+    buffer_[length_++] = symbol;
+  else
+    truncated_ = true;
+  return *this;
+}
+
+
+TextFormatter& TextFormatter::Text(const char *text){
+  while(*text != '\0')
+    Symbol(*(text++));
+  return *this;
+}
+
+
+TextFormatter& TextFormatter::Text(const char *text, const BufferSize length){
+  for(BufferSize i = 0; i < length; i++)
+    Symbol(text[i]);
+  return *this;
+}
+
+
+  //digits are found from the lowest one, then written in reverse
+TextFormatter& TextFormatter::Unsigned(unsigned long long value){
+  char digits[kMaxDecimalDigits];
+  int amount = 0;
+
+  do{
+    digits[amount++] = '0' + static_cast<char>(value % 10);
+    value /= 10;
+  }while(value != 0);
+
+  while(amount > 0)
+    Symbol(digits[--amount]);
+  return *this;
+}
+
+
+TextFormatter& TextFormatter::Signed(const long long value){
+  if(value < 0)
+    Symbol('-');
+  return Unsigned( (value < 0) ? 0ULL - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value) );
+}
+
+
+TextFormatter& TextFormatter::Fixed(const long long value, const int fraction_digits, const int shown_digits){
+  const int dropped_digits = (shown_digits < fraction_digits) ? fraction_digits - shown_digits : 0;
+  const int written_digits = fraction_digits - dropped_digits;
+  const unsigned long long divider = PowerOfTen(dropped_digits);
+
+  unsigned long long magnitude = (value < 0) ? 0ULL - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+  magnitude = (magnitude + divider / 2) / divider;
+
+  //rounded to zero value is written without sign
+  if( (value < 0) && (magnitude != 0) )
+    Symbol('-');
+
+  const unsigned long long point_divider = PowerOfTen(written_digits);
+  Unsigned(magnitude / point_divider);
+
+  if(written_digits == 0)
+    return *this;
+
+  Symbol('.');
+  unsigned long long fraction = magnitude % point_divider;
+  for(unsigned long long digit_divider = point_divider / 10; digit_divider > 0; digit_divider /= 10){
+    Symbol('0' + static_cast<char>(fraction / digit_divider));
+    fraction %= digit_divider;
+  }
+  return *this;
+}
+
+
+const char* TextFormatter::Data() const{
+  return buffer_;
+}
+
+
+BufferSize TextFormatter::Length() const{
+  return length_;
+}
+
+
+bool TextFormatter::IsTruncated() const{
+  return truncated_;
+}
+
+}               //namespace stm32uart
@@ -11,15 +11,18 @@ UartManager::UartManager(){
   //default constructor
 }
 
-UartManager::UartManager(const UartSettings &uart_settings){
+UartManager::UartManager(const UartSettings &uart_settings) : inbox_(uart_settings), outbox_(uart_settings){
   
-  inbox_ = MessageBox(uart_settings);
-  outbox_ = MessageBox(uart_settings);
+  rx_event_handler_ = nullptr;
+  tx_in_progress_ = false;
+  isr_write_index_ = 0;
+  isr_read_index_ = 0;
     
   rx_buffer_ = new CircularBuffer(uart_settings.rx_buffer_size);
   tx_buffer_ = new CircularBuffer(uart_settings.tx_buffer_size);
   
-  if( (rx_buffer_ == nullptr) || (tx_buffer_ == nullptr) || (!tx_buffer_->IsValid()) || (!rx_buffer_->IsValid()) ){
+  if( (rx_buffer_ == nullptr) || (tx_buffer_ == nullptr) || (!tx_buffer_->IsValid()) || (!rx_buffer_->IsValid()) 
+     || (!inbox_.IsValid()) || (!outbox_.IsValid()) ){
     delete tx_buffer_;
     delete rx_buffer_;
     valid_ = false;
@@ -43,27 +46,35 @@ bool UartManager::OutboxEmpty(){
   return outbox_.Empty();
 }
 
-ReturnState UartManager::FillTxBuffer(){
+bool UartManager::TxInProgress() const{
+  return tx_in_progress_;
+}
+
+void UartManager::SetTxInProgress(const bool tx_in_progress){
+  tx_in_progress_ = tx_in_progress;
+}
 
-  String new_tx_buffer_content = "";
+BufferSize UartManager::FillTxBuffer(){
   
-  if( !outbox_.GetNextChunk( tx_buffer_->AllocatedSize(), &new_tx_buffer_content ) )
-    return kOk;
+  tx_buffer_->Reset();
   
-  tx_buffer_->PushChunk(new_tx_buffer_content);
-  return kOk;
+  BufferSize chunk_length = outbox_.GetNextChunk( tx_buffer_->StartAddress(), tx_buffer_->AllocatedSize() );
+  
+  tx_buffer_->IncrementHeadIndex(chunk_length);
+  return chunk_length;
 }
 
 ReturnState UartManager::TakeDataFromRxBuffer(){
   
-  BufferElement element = 0;
-  String new_string = "";
+  BufferSpans received = rx_buffer_->ReadableSpans();
   
-  while(rx_buffer_->PopFront(&element) == kOk){
-    new_string += element;
-  }
+  ReturnState result = inbox_.DropRawData(received.first.start, received.first.length);
   
-  return inbox_.DropRawString(new_string);
+  if( inbox_.DropRawData(received.second.start, received.second.length) == kMessageBoxOverfill )
+    result = kMessageBoxOverfill;
+  
+  rx_buffer_->Consume(received.Length());
+  return result;
 }
 
 CircularBuffer* UartManager::GetRxBufferAddress(){
@@ -74,9 +85,46 @@ CircularBuffer* UartManager::GetTxBufferAddress(){
   return tx_buffer_;
 }
 
+
+void UartManager::SetRxEventHandler(const UartEventHandler handler){
+  rx_event_handler_ = handler;
+}
+
+UartEventHandler UartManager::GetRxEventHandler() const{
+  return rx_event_handler_;
+}
       
-ReturnState UartManager::AddMessageToOutbox(const String message){
-  return outbox_.Put(message);
+ReturnState UartManager::AddMessageToOutbox(const char *message, const BufferSize length){
+  return outbox_.PutLine(message, length);
+}
+
+  //one slot is always left empty, so that full ring differs from empty one
+ReturnState UartManager::AddMessageFromIsr(const char *message, const BufferSize length){
+  
+  if( (length < 0) || (length > uart_configISR_MESSAGE_LENGTH) )
+    return kError;
+  
+  const int write_index = isr_write_index_;
+  const int next_index = (write_index + 1) % uart_configISR_MESSAGE_SLOTS;
+  
+  if(next_index == isr_read_index_)
+    return kMessageBoxOverfill;
+  
+  for(BufferSize i = 0; i < length; i++)
+    isr_messages_[write_index][i] = message[i];
+  isr_message_length_[write_index] = length;
+  
+  isr_write_index_ = next_index;        //slot is published after it is filled
+  return kOk;
+}
+
+void UartManager::MoveIsrMessagesToOutbox(){
+  
+  while(isr_read_index_ != isr_write_index_){
+    const int read_index = isr_read_index_;
+    outbox_.PutLine( reinterpret_cast<const char*>(isr_messages_[read_index]), isr_message_length_[read_index] );
+    isr_read_index_ = (read_index + 1) % uart_configISR_MESSAGE_SLOTS;
+  }
 }
                                                                                         
 ReturnState UartManager::TakeMessageFromInbox(String *message){
@@ -1,5 +1,7 @@
 //file stm32uart_messages.cpp
 
+#include <cstring>
+
 #include "stm32uartConfig.h"
 #include "stm32uart.h"
 #include "stm32uart_messages.h"
@@ -10,28 +12,51 @@ namespace stm32uart{
 // ==== Definitions ====
   
 MessageBox::MessageBox(){
-  //default constructor
+  arena_ = nullptr;
+  arena_size_ = 0;
+  arena_used_ = 0;
+  write_index_ = 0;
+  records_ = nullptr;
+  max_messages_ = 0;
+  first_record_ = 0;
+  records_amount_ = 0;
+  front_offset_ = 0;
+  max_message_length_ = 0;
+  overfill_flag_ = false;
+  valid_ = false;
 }  
   
-MessageBox::MessageBox(const UartSettings &uart_settings){
-  messages_ = {};
-  temp_message_ = "";
+MessageBox::MessageBox(const UartSettings &uart_settings) : MessageBox(){
   max_messages_ = uart_settings.max_messages_stored;
   max_message_length_ = uart_settings.max_message_length;
   eol_symbol_ = uart_settings.eol_symbol;
-  overfill_flag_ = false;
+  temp_message_.reserve(max_message_length_);
+  
+  if( (max_messages_ <= 0) || (max_message_length_ <= 0) )
+    return;
+  
+  arena_size_ = max_messages_ * max_message_length_;
+  arena_ = new BufferElement[arena_size_];
+  records_ = new MessageRecord[max_messages_];
+  
+  valid_ = (arena_ != nullptr) && (records_ != nullptr);
 }
 
 MessageBox::~MessageBox(){
-  //nothing to do in destructor
+  delete[] records_;
+  delete[] arena_;
+}
+
+bool MessageBox::IsValid() const{
+  return valid_;
 }
 
 bool MessageBox::Empty(){
-  return messages_.empty();
+  return records_amount_ == 0;
 }
 
 int MessageBox::Size(){
-  return messages_.size();
+  return records_amount_;
 }
 
 bool MessageBox::ReadOverfillFlag(){
@@ -42,33 +67,98 @@ void MessageBox::ClearOverfillFlag(){
   overfill_flag_ = false;
 }
 
-ReturnState MessageBox::DropRawString(String &new_string){
+void MessageBox::CopyToArena(const BufferSize index, const char *data, const BufferSize length){
+  if(length == 0)
+    return;
+  
+  BufferSize first_part = arena_size_ - index;
+  if(first_part > length)
+    first_part = length;
+  
+  std::memcpy(arena_ + index, data, first_part);
+  std::memcpy(arena_, data + first_part, length - first_part);
+}
+
+void MessageBox::CopyFromArena(const BufferSize index, BufferElement *destination, const BufferSize length) const{
+  if(length == 0)
+    return;
+  
+  BufferSize first_part = arena_size_ - index;
+  if(first_part > length)
+    first_part = length;
+  
+  std::memcpy(destination, arena_ + index, first_part);
+  std::memcpy(destination + first_part, arena_, length - first_part);
+}
+
+void MessageBox::DropFirstRecord(){
+  arena_used_ -= records_[first_record_].length;
+  first_record_ = (first_record_ + 1) % max_messages_;
+  records_amount_--;
+  front_offset_ = 0;
+}
+
+ReturnState MessageBox::PutRecord(const char *data, const BufferSize length, const char *suffix, const BufferSize suffix_length){
+  if(!valid_)
+    return kError;
+  
+  BufferSize record_length = length + suffix_length;
+  
+  if(record_length > arena_size_){
+    overfill_flag_ = true;
+    return kMessageBoxOverfill;
+  }
+  
+  bool overfill = false;
+  while( (records_amount_ >= max_messages_) || ((arena_size_ - arena_used_) < record_length) ){
+    DropFirstRecord();
+    overfill = true;
+  }
+  
+  CopyToArena(write_index_, data, length);
+  CopyToArena((write_index_ + length) % arena_size_, suffix, suffix_length);
+  
+  records_[(first_record_ + records_amount_) % max_messages_] = {write_index_, record_length};
+  records_amount_++;
+  arena_used_ += record_length;
+  write_index_ = (write_index_ + record_length) % arena_size_;
+  
+  if(overfill){
+    overfill_flag_ = true;
+    return kMessageBoxOverfill;
+  }
+  return kOk;
+}
+
+ReturnState MessageBox::DropRawData(const BufferElement *data, const BufferSize length){
   
-  ClearOverfillFlag();
+  bool overfill = false;
+  const char *piece_start = reinterpret_cast<const char*>(data);
+  BufferSize remaining_length = length;
   
-  while(!new_string.empty()){
-    std::string::size_type eol_position = new_string.find(eol_symbol_);      
-    String new_piece = new_string.substr(0, eol_position);
+  while(remaining_length > 0){
+    const char *eol_position = static_cast<const char*>( std::memchr(piece_start, eol_symbol_[0], remaining_length) );
+    BufferSize piece_length = (eol_position == nullptr) ? remaining_length : (eol_position - piece_start);
     
-    if( (temp_message_.length() + new_piece.length()) > max_message_length_){
+    if( (static_cast<BufferSize>(temp_message_.length()) + piece_length) > max_message_length_){
       temp_message_.clear();
     }
     else{
-      temp_message_ += new_piece;
+      temp_message_.append(piece_start, piece_length);
     }
     
-    if(eol_position != std::string::npos){
-        Put(temp_message_);
-        temp_message_.clear();
-    }
+    if(eol_position == nullptr)
+      break;
     
-    if(eol_position == std::string::npos)
-      break;    
+    if(Put(temp_message_) == kMessageBoxOverfill)
+      overfill = true;
+    temp_message_.clear();
     
-    new_string.erase(0, eol_position + 1);
+    piece_start += piece_length + 1;
+    remaining_length -= piece_length + 1;
   }
-  new_string.erase();
-  if(ReadOverfillFlag())
+  
+  if(overfill)
     return kMessageBoxOverfill;
   return kOk;
 }
@@ -77,82 +167,68 @@ ReturnState MessageBox::Put(const String &new_message){
   if(new_message.empty())
     return kOk;
   
-  bool overfill = false;
-  if (messages_.size() >= max_messages_){
-    overfill_flag_ = true;
-    overfill = true;
-  }
-  
-  while(messages_.size() >= max_messages_)
-    messages_.pop_front();
-    
-  messages_.emplace_back(new_message);
-  
-  if(overfill)
-    return kMessageBoxOverfill;
-  return kOk;  
+  return PutRecord(new_message.data(), new_message.length(), nullptr, 0);
+}
+
+ReturnState MessageBox::PutLine(const String &text){
+  return PutRecord(text.data(), text.length(), eol_symbol_.data(), eol_symbol_.length());
+}
+
+ReturnState MessageBox::PutLine(const char *text, const BufferSize length){
+  return PutRecord(text, length, eol_symbol_.data(), eol_symbol_.length());
 }
 
 ReturnState MessageBox::GetNext(String *message){
   message->clear();
   
-  if(messages_.empty())
+  if(records_amount_ == 0)
     return kNoPendingMessages;
   
-  *message = messages_.front();
-  messages_.pop_front();
+  const MessageRecord &record = records_[first_record_];
+  BufferSize start = (record.offset + front_offset_) % arena_size_;
+  BufferSize length = record.length - front_offset_;
+  
+  BufferSize first_part = arena_size_ - start;
+  if(first_part > length)
+    first_part = length;
+  
+  message->append(reinterpret_cast<const char*>(arena_ + start), first_part);
+  message->append(reinterpret_cast<const char*>(arena_), length - first_part);
+  
+  DropFirstRecord();
   return kOk;
 }
 
 ReturnState MessageBox::GetNextElement(BufferElement *element){
   *element = 0;
   
-  if(messages_.empty())
+  if(GetNextChunk(element, 1) == 0)
     return kNoPendingMessages;
-  
-  String tmp_string = messages_.front();
-  
-  *element = tmp_string[0];
-  tmp_string.erase(0,1);
-  
-  if(tmp_string.empty())
-    messages_.pop_front();
-  else
-    messages_.front() = tmp_string;
  
   return kOk;
 }
 
-bool MessageBox::GetNextChunk(const BufferSize chunk_length, String *message){
-  message->clear();
-  
-  if(messages_.empty() || (chunk_length <= 0))
-    return false;
+BufferSize MessageBox::GetNextChunk(BufferElement *destination, const BufferSize chunk_length){
   
-  int counter = chunk_length;
+  BufferSize copied = 0;
   
-  while(counter > 0){
+  while( (copied < chunk_length) && (records_amount_ > 0) ){
     
-    String tmp_message = messages_.front();
+    const MessageRecord &record = records_[first_record_];
     
-    if(tmp_message.length() <= counter){
-      *message += tmp_message;
-      counter -= tmp_message.length();
-      messages_.pop_front();
-    }
+    BufferSize piece_length = record.length - front_offset_;
+    if(piece_length > (chunk_length - copied))
+      piece_length = chunk_length - copied;
     
-    else {
-      *message += tmp_message.substr(0, counter);
-      tmp_message.erase(0, counter);
-      messages_.front() = tmp_message;
-      break;
-    }
+    CopyFromArena( (record.offset + front_offset_) % arena_size_, destination + copied, piece_length );
+    copied += piece_length;
+    front_offset_ += piece_length;
     
-    if(messages_.empty())
-      break;
+    if(front_offset_ == record.length)
+      DropFirstRecord();
   }
   
-  return true;  
+  return copied;  
 }
 
   
@@ -2,9 +2,9 @@
 #define STM32_UART_CONFIG_H
 
 #define uart_configDEFAULT_CPU_FREQUENCY 72000000UL
-#define uart_configDEFAULT_RX_BUFFER_SIZE 32
+#define uart_configDEFAULT_RX_BUFFER_SIZE 128
 #define uart_configDEFAULT_TX_BUFFER_SIZE 32
-#define uart_configDEFAULT_MAX_MESSAGE_LENGTH 20
+#define uart_configDEFAULT_MAX_MESSAGE_LENGTH 32
 #define uart_configDEFAULT_MAX_MESSAGES_STORED 25
 #define uart_configDEFAULT_EOL_SYMBOL "\n"
 
@@ -12,5 +12,13 @@
 
 #define uart_configENABLE_UART1
 
+//messages, sent from interrupts (see SendMessageFromIsr()), wait for tx interrupt in slots of fixed length
+#define uart_configISR_MESSAGE_SLOTS 4
+#define uart_configISR_MESSAGE_LENGTH 32
+
+//NVIC priority of uart and its DMA interrupts. Should be numerically not lower than
+//configMAX_SYSCALL_INTERRUPT_PRIORITY level, if event handlers use FreeRTOS "FromISR" API
+#define uart_configIRQ_PRIORITY 13
+
 
 #endif          //STM32_UART_CONFIG_H
\ No newline at end of file
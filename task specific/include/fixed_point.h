@@ -0,0 +1,98 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+namespace voltmeter{
+
+//Integer arithmetic helpers for measurements: Cortex-M3 has no FPU,
+//so voltages are computed in fixed point instead of soft float
+
+  //floor of square root, bit by bit (no division, no float)
+inline unsigned long long IntegerSqrt(unsigned long long value){
+  unsigned long long root = 0;
+  unsigned long long bit = 1ULL << 62;
+
+  while(bit > value)
+    bit >>= 2;
+
+  while(bit != 0){
+    if(value >= root + bit){
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+      root >>= 1;
+    bit >>= 2;
+  }
+  return root;
+}
+
+
+  //-value- * -multiplier- >> -shift-, rounded to nearest; product must fit in 64 bits
+inline long long MultiplyShift(const long long value, const long long multiplier, const int shift){
+  const long long product = value * multiplier;
+  const long long half = 1LL << (shift - 1);
+  return (product >= 0) ? (product + half) >> shift : -((-product + half) >> shift);
+}
+
+
+  //angles are radians with kAngleShift fractional bits
+constexpr int kAngleShift = 30;
+constexpr long long kPi = 3373259426LL;
+constexpr long long kTwoPi = 2 * kPi;
+
+
+  //sine and cosine (kAngleShift fractional bits) of -angle- within [-pi/2, pi/2], by Taylor series
+inline void SineCosine(const long long angle, long long *sine, long long *cosine){
+  const long long one = 1LL << kAngleShift;
+  const long long square = (angle * angle) >> kAngleShift;
+  
+  //(2k)(2k+1) and (2k-1)(2k) of series terms, from the last one
+  static constexpr long long kSineDivisors[] = {110, 72, 42, 20, 6};
+  static constexpr long long kCosineDivisors[] = {132, 90, 56, 30, 12, 2};
+  
+  long long series = one;
+  for(long long divisor : kSineDivisors)
+    series = one - ((square * series) >> kAngleShift) / divisor;
+  *sine = (angle * series) >> kAngleShift;
+  
+  series = one;
+  for(long long divisor : kCosineDivisors)
+    series = one - ((square * series) >> kAngleShift) / divisor;
+  *cosine = series;
+}
+
+
+  //angle of vector (-x-, -y-) within (-pi, pi], error is about 1e-5 radian
+inline long long Atan2(long long y, long long x){
+  if( (x == 0) && (y == 0) )
+    return 0;
+  
+  while( (x >= (1LL << 31)) || (x <= -(1LL << 31)) || (y >= (1LL << 31)) || (y <= -(1LL << 31)) ){
+    x /= 2;
+    y /= 2;
+  }
+  
+  const long long abs_x = (x < 0) ? -x : x;
+  const long long abs_y = (y < 0) ? -y : y;
+  const bool steep = abs_y > abs_x;
+  const long long ratio = steep ? (abs_x << kAngleShift) / abs_y : (abs_y << kAngleShift) / abs_x;
+  const long long ratio_square = (ratio * ratio) >> kAngleShift;
+  
+  //polynomial approximation of atan() on [0, 1], odd powers from 9th down to 1st, kAngleShift fractional bits
+  static constexpr long long kCoefficients[] = {22371518LL, -91410863LL, 193424926LL, -354656388LL, 1073597943LL};
+  
+  long long angle = 0;
+  for(long long coefficient : kCoefficients)
+    angle = coefficient + ((angle * ratio_square) >> kAngleShift);
+  angle = (angle * ratio) >> kAngleShift;
+  
+  if(steep)
+    angle = kPi / 2 - angle;
+  if(x < 0)
+    angle = kPi - angle;
+  return (y < 0) ? -angle : angle;
+}
+
+}               //namespace voltmeter
+
+#endif          //FIXED_POINT_H
@@ -0,0 +1,69 @@
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+namespace voltmeter{
+
+//Fixed-capacity ring of samples with contiguous storage
+//Capacity should be a power of two, so wrapping is a single mask operation
+//No allocations after construction: object can be filled from interrupt
+template <typename Element, int kCapacity>
+class SampleRing{
+  static_assert( (kCapacity > 0) && ((kCapacity & (kCapacity - 1)) == 0), "SampleRing capacity must be a power of two" );
+private:
+  static constexpr int kIndexMask = kCapacity - 1;
+  
+  Element elements_[kCapacity];
+  int tail_index_;
+  int size_;
+public:
+  SampleRing(){
+    Clear();
+  }
+  
+  static constexpr int Capacity(){
+    return kCapacity;
+  }
+  
+  int Size() const{
+    return size_;
+  }
+  
+  bool Empty() const{
+    return size_ == 0;
+  }
+  
+  bool Full() const{
+    return size_ == kCapacity;
+  }
+  
+  void Clear(){
+    tail_index_ = 0;
+    size_ = 0;
+  }
+  
+  //if ring is full, the oldest element is overwritten
+  void PushBack(const Element &element){
+    elements_[(tail_index_ + size_) & kIndexMask] = element;
+    if(size_ < kCapacity)
+      size_++;
+    else
+      tail_index_ = (tail_index_ + 1) & kIndexMask;
+  }
+  
+  //removes and returns the oldest element, ring should not be empty
+  Element PopFront(){
+    const Element element = elements_[tail_index_];
+    tail_index_ = (tail_index_ + 1) & kIndexMask;
+    size_--;
+    return element;
+  }
+  
+  //-index- = 0 is the oldest element
+  const Element& operator[](const int index) const{
+    return elements_[(tail_index_ + index) & kIndexMask];
+  }
+};
+
+}               //namespace voltmeter
+
+#endif          //SAMPLE_RING_H
\ No newline at end of file
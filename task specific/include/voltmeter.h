@@ -3,17 +3,17 @@
 
 #include <list>
 #include <map>
+#include <memory>
 
-#include "freeRTOS.h"
+#include "FreeRTOS.h"
 
 #include "stm32uart.h"
+#include "stm32uart_format.h"
 #include "stm32adc.h"
 
 
 namespace voltmeter {
   
-const int kMaxSimultaneouslyWorkingChannels = 3;
-  
 typedef enum {
   kOk,
   kError,
@@ -25,13 +25,16 @@ typedef enum {
   kStartCommand,
   kStopCommand,
   kResultCommand, 
-  kStatusCommand  }     CommandDescriptor;
+  kStatusCommand,
+  kAlarmCommand   }     CommandDescriptor;
 
 typedef enum {
   kNoMode,
   kModeInstant,
   kModeAverage,
-  kModeRMS      }       ChannelMode;
+  kModeRMS,
+  kModeFrequency,
+  kModeHarmonics }      ChannelMode;
 
 
 typedef enum {
@@ -42,11 +45,22 @@ typedef enum {
 
 typedef std::list<std::string> ParamsList;
 
-typedef float Voltage;
+  //Cortex-M3 has no FPU, so voltages are integer microvolts
+  //and adc levels, which may be fractional (means, oversampled values), are fixed point with kAdcLevelShift fractional bits
+typedef long Microvolts;
+typedef unsigned long AdcLevel;
 typedef stm32adc::AdcValue AdcValue;
+typedef stm32adc::AdcSample AdcSample;
 typedef std::pair<AdcValue, AdcValue> AdcBounds;
-typedef std::pair<Voltage, Voltage> VoltageBounds;
+typedef std::pair<Microvolts, Microvolts> VoltageBounds;
 typedef TickType_t TimeMs;
+typedef stm32adc::Timestamp Timestamp;
+
+constexpr int kAdcLevelShift = 16;
+
+  //responses are formatted on stack, without heap; longest one (status line) fits in 96 bytes
+constexpr stm32uart::BufferSize kResponseLength = 96;
+typedef stm32uart::TextBuffer<kResponseLength> ResponseText;
 
 class VoltageAdcRangeMap;
 class IVoltmeterChannel;
@@ -65,12 +79,24 @@ private:
   
   static VoltmeterState state_;
   
+    //channel of hardware watchdog alarm (kNoChannel: all channels), valid while -hardware_alarm_set_-
+  static bool hardware_alarm_set_;
+  static stm32adc::AdcChannel hardware_alarm_channel_;
+  
   static void ProcessStartCommand(const ParamsList &parsed_message);
   static void ProcessStopCommand(const ParamsList &parsed_message);
   static void ProcessResultCommand(const ParamsList &parsed_message);
   static void ProcessStatusCommand(const ParamsList &parsed_message);
+  static void ProcessAlarmCommand(const ParamsList &parsed_message);
+  
+  static ReturnState AdcThresholdFromVoltage(const Microvolts voltage, AdcSample *threshold);
+  static void AlarmHandler(void* context, const stm32adc::AdcChannel channel, 
+                           const stm32adc::ThresholdCrossing crossing, const AdcSample sample);
+  
+  static int GetChannelsLimit(const ChannelMode mode);
+  static int GetMemoryCapacity(const ChannelMode mode);
   
-  static ReturnState GetChannelValue(const stm32adc::AdcChannel channel, std::string *result_string);
+  static ReturnState GetChannelValue(const stm32adc::AdcChannel channel, stm32uart::TextFormatter *result_string);
   static void DumpChannelValues(const stm32adc::AdcChannel channel);
   
   Voltmeter() = delete;
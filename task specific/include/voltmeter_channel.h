@@ -1,26 +1,41 @@
 #ifndef VOLTMETER_CHANNEL_H
 #define VOLTMETER_CHANNEL_H
 
+#include <cstddef>
 #include <map>
 #include <list>
 
-#include "freeRTOS.h"
-#include "timers.h" 
+#include "FreeRTOS.h"
+#include "task.h" 
 
 #include "voltmeter.h"
+#include "sample_ring.h"
+#include "fixed_point.h"
 
 namespace voltmeter{
 
 
+//Linear map of adc levels to voltage
+//Scale (microvolts per adc level) is computed once, when map is set, so conversion is one 64-bit multiply
 class VoltageAdcRangeMap{
 private:
   AdcBounds adc_bounds_;
   VoltageBounds voltage_bounds_;
+    //microvolts per adc level with kScaleShift fractional bits, 0 for degenerate map
+  long long scale_;
+  
+  void ComputeScale();
 public:
+  static constexpr int kScaleShift = 16;
+  
   VoltageAdcRangeMap();
   VoltageAdcRangeMap(const AdcBounds &new_adc_bounds, const VoltageBounds &new_voltage_bounds);
   VoltageAdcRangeMap(const VoltageAdcRangeMap &map_to_copy);
-  ReturnState GetVoltageByAdc(const AdcValue input_adc, Voltage* result_voltage);
+  VoltageAdcRangeMap& operator=(const VoltageAdcRangeMap &map_to_copy);
+  ReturnState GetVoltageByAdc(const AdcValue input_adc, Microvolts* result_voltage) const;
+  ReturnState GetVoltageByAdcLevel(const AdcLevel adc_level, Microvolts* result_voltage) const;
+  ReturnState GetAdcLevelByVoltage(const Microvolts input_voltage, AdcLevel* result_adc_level) const;
+  Microvolts GetVoltageSpan(const AdcLevel adc_span) const;
 };
 
 
@@ -29,49 +44,168 @@ protected:
   VoltageAdcRangeMap voltage_adc_range_map_;
   stm32adc::AdcHardwareNumber adc_number_;
   stm32adc::AdcChannel channel_;
+  
+  AdcLevel CorrectAdcLevel(const AdcLevel adc_level) const;
 public:
   IVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
                     const stm32adc::AdcHardwareNumber adc_number, 
                     const stm32adc::AdcChannel channel);
   virtual ~IVoltmeterChannel();
-  virtual ReturnState GetValue(std::string *value) = 0;
-  virtual ReturnState DropMeasurement(const AdcValue new_measurement) = 0;
+  
+  //channels are allocated in FreeRTOS heap, so that free memory is known (see Voltmeter::GetChannelsLimit())
+  static void* operator new(std::size_t size);
+  static void operator delete(void* pointer);
+  
+  //value is appended to -value- text on success
+  virtual ReturnState GetValue(stm32uart::TextFormatter *value) = 0;
+  //-timestamp- is the time of sample, in CPU cycles (see stm32adc::Timestamp)
+  virtual ReturnState DropMeasurement(const AdcValue new_measurement, const Timestamp timestamp) = 0;
   virtual void DumpValues();
+  //false for channels, converted on request, they do not take a slot of Adc scan list
+  virtual bool UsesScanList() const;
   ReturnState TakeMeasurement(AdcValue *measurement);
+  stm32adc::AdcHardwareNumber GetAdcNumber() const;
+  stm32adc::AdcChannel GetAdcChannel() const;
 };
 
 
-class IFreeRtosTimerUsage{
+//Channel receives samples from Adc stream (in interrupt context)
+//every -decimation_- sample of the stream is dropped to the channel
+class IAdcStreamUsage{
 protected:
-  TimerHandle_t timer_;
+  IVoltmeterChannel* subscriber_;
+  int decimation_;
+  int decimation_counter_;
+    //nominal time between dropped samples, CPU cycles
+  unsigned long measurement_interval_;
   
-  static std::map<TimerHandle_t, IVoltmeterChannel*> timers_map_;
-  void ClearFreeRtosTimer();  
+  ReturnState SubscribeToAdcStream( IVoltmeterChannel* subscriber, const TimeMs measurements_period );
+  void ClearAdcSubscription();
 public:
-  IFreeRtosTimerUsage();
-  virtual ~IFreeRtosTimerUsage();
-  static void FreeRtosTimerCallback( TimerHandle_t timer );
-  void SetTimerHandle( const TimerHandle_t new_timer );
-  
+  IAdcStreamUsage();
+  virtual ~IAdcStreamUsage();
+  static void AdcSamplesCallback( void* context, const stm32adc::ChannelSamples &samples );
 };
 
 
+//Reports the last value of Adc channel
+//With oversampling order > 0, this value is the extended precision mean of 4^order samples, taken from scan list
+//With order 0, channel is not scanned: each request converts it once (injected conversion)
 class InstantVoltmeterChannel : public IVoltmeterChannel{
+private:
+  stm32adc::OversamplingOrder oversampling_order_;
+  bool on_demand_;
 public:
   InstantVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
                           const stm32adc::AdcHardwareNumber adc_number, 
-                          const stm32adc::AdcChannel channel);
+                          const stm32adc::AdcChannel channel,
+                          const stm32adc::OversamplingOrder oversampling_order = 0);
   ~InstantVoltmeterChannel() override;
-  ReturnState GetValue(std::string *value) override;
-  ReturnState DropMeasurement(const AdcValue new_measurement) override;
+  ReturnState GetValue(stm32uart::TextFormatter *value) override;
+  ReturnState DropMeasurement(const AdcValue new_measurement, const Timestamp timestamp) override;
+  bool UsesScanList() const override;
 };
 
 
-class RMSVoltmeterChannel : public IVoltmeterChannel, public IFreeRtosTimerUsage{
+//Detects rising crossings of signal mid level with hysteresis
+//Mid level is the running mean of samples (AC input rides on DC offset), 
+//hysteresis follows peak-to-peak of the last period, so that noise does not make extra crossings
+//Crossing time is interpolated linearly between the two samples around mid level
+class CrossingDetector{
 private:
-  std::list<AdcValue> measurements_;
+    //mid level, adc level with kAdcLevelShift fractional bits
+  long mid_level_;
+  long hysteresis_;
+  AdcSample period_min_;
+  AdcSample period_max_;
+  AdcSample last_sample_;
+  Timestamp last_timestamp_;
+    //signal went below mid level - hysteresis, rising crossing is expected
+  bool armed_;
+  bool started_;
+public:
+  CrossingDetector();
+  void Reset();
+  //returns true, if signal crossed mid level upwards since previous sample, then -crossing_time- is set
+  bool Feed(const AdcSample sample, const Timestamp timestamp, Timestamp *crossing_time);
+};
+
+
+  //maximum amount of samples in window of a channel (power of two)
+  //each window costs 2 * kChannelWindowCapacity bytes of heap
+constexpr int kChannelWindowCapacity = 128;
+
+typedef SampleRing<AdcSample, kChannelWindowCapacity> ChannelWindow;
+
+  //samples of coherent window are weighted, weights have kWindowWeightShift fractional bits
+constexpr int kWindowWeightShift = 8;
+  //window keeps this amount of older samples besides its own ones for weighted ends of coherent span
+constexpr int kSpareSamples = 2;
+
+  //-weight- is amount of samples, -sum- and -sum_of_squares- are weighted, all with kWindowWeightShift fractional bits
+  //-periods- of input signal, the window spans exactly (0 - window is not coherent)
+struct WindowStatistics {
+  int amount;
+  unsigned long weight;
+  unsigned long long sum;
+  unsigned long long sum_of_squares;
+  int periods;
+};
+
+
+//Sliding window of the last -required_measurements_amount_- samples
+//Sum and sum of squares of the window are updated on every sample, 
+//so statistics of the window are available in O(1)
+//Samples of the window are contiguous in time: their timestamps are checked, and if a sample comes 
+//not in its time (samples were lost), the window is restarted rather than integrated over the gap
+//For AC input, window is coherent: period of input is tracked by its crossings, and statistics are taken 
+//over the newest samples, which span exactly the whole number of periods (as many as the window holds). 
+//Span is not a whole number of samples, so the ends are weighted as in trapezoid integration
+//(kSpareSamples older samples are kept for that).
+//Sum and sum of squares of whole samples of coherent window are updated on every sample too.
+class IWindowVoltmeterChannel : public IVoltmeterChannel, public IAdcStreamUsage{
+protected:
+  ChannelWindow measurements_;
   int required_measurements_amount_;
   TimeMs measurements_period_;
+  unsigned long sum_;
+  unsigned long long sum_of_squares_;
+  Timestamp last_timestamp_;
+  unsigned long window_restarts_;
+  
+  CrossingDetector detector_;
+  Timestamp last_crossing_;
+  bool crossing_seen_;
+    //smoothed period of input, CPU cycles, 0 if not known
+  unsigned long signal_period_;
+  int period_outliers_;
+  int coherent_periods_;
+    //whole samples of coherent span and its fractional part (kWindowWeightShift bits)
+  int coherent_length_;
+  unsigned long coherent_fraction_;
+  unsigned long coherent_sum_;
+  unsigned long long coherent_sum_of_squares_;
+  
+  void UpdateSignalPeriod(const AdcSample sample, const Timestamp timestamp);
+  void UpdateCoherentSpan();
+  void SetCoherentLength(const int length);
+  bool TakeWindowStatistics(WindowStatistics *statistics);
+public:
+  IWindowVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
+                          const stm32adc::AdcHardwareNumber adc_number, 
+                          const stm32adc::AdcChannel channel, 
+                          const int measurements_amount,
+                          const TimeMs measurements_period);
+  ~IWindowVoltmeterChannel() override;
+  ReturnState DropMeasurement(const AdcValue new_measurement, const Timestamp timestamp) override;
+  
+  //debug
+  void DumpValues() override;
+};
+
+
+//Reports true RMS, DC mean and AC RMS of the window
+class RMSVoltmeterChannel : public IWindowVoltmeterChannel{
 public:
   RMSVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
                       const stm32adc::AdcHardwareNumber adc_number, 
@@ -79,19 +213,11 @@ public:
                       const int measurements_amount,
                       const TimeMs measurements_period);
   ~RMSVoltmeterChannel() override;
-  ReturnState GetValue(std::string *value) override;
-  ReturnState DropMeasurement(const AdcValue new_measurement) override;
-  
-  //debug
-  void DumpValues() override;
+  ReturnState GetValue(stm32uart::TextFormatter *value) override;
 };
 
 
-class AverageVoltmeterChannel : public IVoltmeterChannel, public IFreeRtosTimerUsage{
-private:
-  std::list<AdcValue> measurements_;
-  int required_measurements_amount_;
-  TimeMs measurements_period_;
+class AverageVoltmeterChannel : public IWindowVoltmeterChannel{
 public:
   AverageVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
                           const stm32adc::AdcHardwareNumber adc_number, 
@@ -99,14 +225,118 @@ public:
                           const int measurements_amount,
                           const TimeMs measurements_period);
   ~AverageVoltmeterChannel() override;
-  ReturnState GetValue(std::string *value) override;  
-  ReturnState DropMeasurement(const AdcValue new_measurement) override;
+  ReturnState GetValue(stm32uart::TextFormatter *value) override;  
+};
+
+
+  //periods, averaged by frequency channel (power of two)
+constexpr int kFrequencyPeriodsCapacity = 16;
+
+typedef SampleRing<unsigned long, kFrequencyPeriodsCapacity> PeriodsWindow;
+
+
+//Reports frequency (0.01 Hz resolution) and period jitter of AC input, 
+//measured by rising crossings over the last kFrequencyPeriodsCapacity periods
+//Every sample of Adc stream is used. If samples were lost, or no crossing is seen 
+//during the longest period, measurement is restarted
+class FrequencyVoltmeterChannel : public IVoltmeterChannel, public IAdcStreamUsage{
+private:
+  CrossingDetector detector_;
+  PeriodsWindow periods_;
+    //bounds of valid period, CPU cycles
+  unsigned long min_period_;
+  unsigned long max_period_;
+  Timestamp last_crossing_;
+  Timestamp last_timestamp_;
+  bool crossing_seen_;
+  unsigned long restarts_;
+  
+  void Restart();
+public:
+  FrequencyVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
+                            const stm32adc::AdcHardwareNumber adc_number, 
+                            const stm32adc::AdcChannel channel);
+  ~FrequencyVoltmeterChannel() override;
+  ReturnState GetValue(stm32uart::TextFormatter *value) override;
+  ReturnState DropMeasurement(const AdcValue new_measurement, const Timestamp timestamp) override;
   
   //debug
   void DumpValues() override;
 };
 
 
+
+  //harmonics, analysed by harmonics channel, the 1st one is fundamental
+constexpr int kMaxHarmonics = 15;
+constexpr int kDefaultHarmonics = 7;
+
+//Goertzel filter of one harmonic: cos, sin of its frequency per sample and two last states of filter
+struct GoertzelFilter {
+  long long cosine;
+  long long sine;
+  long long state;
+  long long previous_state;
+};
+
+//Result of one block: DFT value of each harmonic (not scaled by block length)
+struct HarmonicsBlock {
+  long long real[kMaxHarmonics];
+  long long imaginary[kMaxHarmonics];
+  int harmonics;
+  int samples;
+  int periods;
+  Timestamp duration;
+};
+
+
+//Reports fundamental, harmonics (amplitude, phase to fundamental) and THD of AC input
+//Bank of Goertzel filters runs on every sample of Adc stream (in interrupt), so cost is spread over samples.
+//Block of samples spans whole number of periods between rising crossings, so harmonics fall on DFT bins.
+//Result of the last block is kept, so query does not depend on block length
+class HarmonicsVoltmeterChannel : public IVoltmeterChannel, public IAdcStreamUsage{
+private:
+  CrossingDetector detector_;
+  GoertzelFilter filters_[kMaxHarmonics];
+  int harmonics_amount_;
+    //harmonics of current block, which are below Nyquist frequency
+  int active_harmonics_;
+  
+  Timestamp last_crossing_;
+  Timestamp last_timestamp_;
+  bool crossing_seen_;
+  
+  bool block_running_;
+  int block_periods_;
+  int periods_in_block_;
+  int block_samples_;
+  Timestamp block_start_;
+  unsigned long block_sum_;
+    //DC level of input, removed before filters, adc level with kGoertzelStateShift fractional bits
+  long dc_level_;
+  bool dc_known_;
+  
+  HarmonicsBlock result_;
+  bool result_ready_;
+  unsigned long restarts_;
+  
+  void Restart();
+  void StartBlock(const Timestamp start_time, const Timestamp period);
+  void FinishBlock(const Timestamp end_time);
+  bool TakeResult(HarmonicsBlock *result);
+public:
+  HarmonicsVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
+                            const stm32adc::AdcHardwareNumber adc_number, 
+                            const stm32adc::AdcChannel channel,
+                            const int harmonics_amount = kDefaultHarmonics);
+  ~HarmonicsVoltmeterChannel() override;
+  ReturnState GetValue(stm32uart::TextFormatter *value) override;
+  ReturnState DropMeasurement(const AdcValue new_measurement, const Timestamp timestamp) override;
+  
+  //amplitude and phase of each harmonic
+  void DumpValues() override;
+};
+
+
 }               //namespace voltmeter
 
 
@@ -10,22 +10,28 @@ namespace LedBlinker {
 
 ReturnStatus Led::Init(){
   
+#ifndef VOLTMETER_POSIX_PORT
   RCC->APB2ENR |= RCC_APB2ENR_IOPCEN;   //Allow clock source of GPIOC
   
   GPIOC->CRH |= GPIO_CRH_MODE13;
   GPIOC->CRH &= (~(GPIO_CRH_CNF13));
+#endif  //VOLTMETER_POSIX_PORT
   
   LedOff();
   return RETURN_OK;
 }
 
 void Led::LedOn(){
+#ifndef VOLTMETER_POSIX_PORT
   GPIOC->BRR |= GPIO_ODR_ODR13;
+#endif  //VOLTMETER_POSIX_PORT
   current_state = LED_IS_ON;
 }
 
 void Led::LedOff(){
+#ifndef VOLTMETER_POSIX_PORT
   GPIOC->BSRR |= GPIO_ODR_ODR13;
+#endif  //VOLTMETER_POSIX_PORT
   current_state = LED_IS_OFF;
 }
 
@@ -1,4 +1,6 @@
 //file voltmeter.cpp
+#include <algorithm>
+
 #include "stm32adc.h"
 #include "voltmeter.h"
 #include "voltmeter_channel.h"
@@ -8,11 +10,16 @@ namespace voltmeter{
   
 constexpr stm32uart::UartHardwareNumber kDefaultUart = stm32uart::kUart1;
 constexpr stm32adc::AdcHardwareNumber kDefaultAdc = stm32adc::kAdc1;
-constexpr Voltage kDefaultMinVoltage = 0;
-constexpr Voltage kDefaultMaxVoltage = 3.3;
+constexpr Microvolts kDefaultMinVoltage = 0;
+constexpr Microvolts kDefaultMaxVoltage = 3300000;
 constexpr int kDefaultMeasurementsAmount = 20;
 constexpr TimeMs kDefaultMeasurementsPeriod = 2;
 
+  //FreeRTOS heap, which is left for the rest of application when channels limit is reached
+constexpr std::size_t kHeapReserve = 1024;
+  //heap_4 block header, which precedes every allocated channel
+constexpr std::size_t kHeapBlockHeader = 8;
+
 
 
 stm32uart::UartHardwareNumber Voltmeter::assigned_uart_ = kDefaultUart;
@@ -20,6 +27,8 @@ stm32adc::AdcHardwareNumber Voltmeter::assigned_adc_ = kDefaultAdc;
 VoltmeterState Voltmeter::state_ = kVoltmeterIdle;
 std::map <stm32adc::AdcChannel, VoltmeterChannelPtr> Voltmeter::active_channels_ = {};
 std::list<std::string> Voltmeter::errors_list_ = {};
+bool Voltmeter::hardware_alarm_set_ = false;
+stm32adc::AdcChannel Voltmeter::hardware_alarm_channel_ = stm32adc::kNoChannel;
 
 
 const VoltageAdcRangeMap kDefaultVoltageAdcRangeMap = VoltageAdcRangeMap( {0, stm32adc::kMaxAdcValue}, {kDefaultMinVoltage, kDefaultMaxVoltage} );
@@ -34,6 +43,8 @@ static CommandDescriptor CommandDescriptorFromString(const std::string &string){
     return kResultCommand;
   if(string == "status")
     return kStatusCommand;
+  if(string == "alarm")
+    return kAlarmCommand;
   return kNoCommand;
 }
 
@@ -77,6 +88,97 @@ static stm32adc::AdcChannel AdcChannelFromString(const std::string &string){
 }
 
 
+  //"os<order>", e.g. "os3" for 4^3 = 64 samples per value
+static bool OversamplingOrderFromString(const std::string &string, stm32adc::OversamplingOrder *order){
+  if( (string.length() != 3) || (string.compare(0, 2, "os") != 0) )
+    return false;
+  
+  const int digit = string[2] - '0';
+  if( (digit < 0) || (digit > stm32adc::kMaxOversamplingOrder) )
+    return false;
+  
+  *order = digit;
+  return true;
+}
+
+
+  //"h<amount>", e.g. "h7" for fundamental and harmonics up to the 7th
+static bool HarmonicsAmountFromString(const std::string &string, int *amount){
+  if( (string.length() < 2) || (string.length() > 3) || (string[0] != 'h') )
+    return false;
+  
+  int number = 0;
+  for(std::string::size_type index = 1; index < string.length(); index++){
+    const int digit = string[index] - '0';
+    if( (digit < 0) || (digit > 9) )
+      return false;
+    number = number * 10 + digit;
+  }
+  
+  if( (number < 1) || (number > kMaxHarmonics) )
+    return false;
+  
+  *amount = number;
+  return true;
+}
+
+
+  //whole string must be a number of volts, e.g. "3.21" or "-0.5", digits beyond microvolts are ignored
+static bool VoltageFromString(const std::string &string, Microvolts *voltage){
+  constexpr int kMaxIntegerDigits = 3;
+  constexpr int kFractionDigits = 6;
+  
+  std::string::size_type index = 0;
+  const bool negative = (!string.empty()) && (string[0] == '-');
+  if(negative)
+    index++;
+  
+  long integer_part = 0;
+  long fraction_part = 0;
+  int integer_digits = 0;
+  int fraction_digits = 0;
+  bool point_found = false;
+  
+  for( ; index < string.length(); index++){
+    const char symbol = string[index];
+    if( (symbol == '.') && (!point_found) ){
+      point_found = true;
+      continue;
+    }
+    if( (symbol < '0') || (symbol > '9') )
+      return false;
+    
+    if(!point_found){
+      if(++integer_digits > kMaxIntegerDigits)
+        return false;
+      integer_part = integer_part * 10 + (symbol - '0');
+    }
+    else if(fraction_digits < kFractionDigits){
+      fraction_part = fraction_part * 10 + (symbol - '0');
+      fraction_digits++;
+    }
+  }
+  
+  if( (integer_digits == 0) && (fraction_digits == 0) )
+    return false;
+  
+  for( ; fraction_digits < kFractionDigits; fraction_digits++)
+    fraction_part *= 10;
+  
+  *voltage = (negative ? -1 : 1) * (integer_part * 1000000L + fraction_part);
+  return true;
+}
+
+
+  //"<prefix><channel><suffix>" - the most common form of response
+static void SendChannelMessage(const stm32uart::UartHardwareNumber uart, const char *prefix, 
+                               const stm32adc::AdcChannel channel, const char *suffix){
+  ResponseText response;
+  response.Text(prefix).Unsigned(channel).Text(suffix);
+  stm32uart::SendMessage(uart, response);
+}
+
+
 static ChannelMode ChannelModeFromString(const std::string &string){
   if(string == "none")
     return kModeInstant;
@@ -84,10 +186,32 @@ static ChannelMode ChannelModeFromString(const std::string &string){
     return kModeRMS;
   if(string == "avg")
     return kModeAverage;
+  if(string == "freq")
+    return kModeFrequency;
+  if(string == "harm")
+    return kModeHarmonics;
   
   return kNoMode;
 }
 
+
+  //heap usage of channel, which is created for given mode
+static std::size_t ChannelHeapFootprint(const ChannelMode mode){
+  switch(mode){
+  case kModeInstant:
+    return sizeof(InstantVoltmeterChannel) + kHeapBlockHeader;
+  case kModeAverage:
+    return sizeof(AverageVoltmeterChannel) + kHeapBlockHeader;
+  case kModeFrequency:
+    return sizeof(FrequencyVoltmeterChannel) + kHeapBlockHeader;
+  case kModeHarmonics:
+    return sizeof(HarmonicsVoltmeterChannel) + kHeapBlockHeader;
+  case kModeRMS:
+  default:
+    return sizeof(RMSVoltmeterChannel) + kHeapBlockHeader;
+  }
+}
+
     
 void Voltmeter::ProcessStartCommand(const ParamsList &parsed_message){
   ChannelMode new_channel_mode = kNoMode;
@@ -105,25 +229,81 @@ void Voltmeter::ProcessStartCommand(const ParamsList &parsed_message){
       break;
   }
   
+  bool oversampling_requested = false;
+  stm32adc::OversamplingOrder oversampling_order = 0;
+  for(auto it : parsed_message){
+    oversampling_requested = OversamplingOrderFromString(it, &oversampling_order);
+    if(oversampling_requested)
+      break;
+  }
+  
+  bool harmonics_requested = false;
+  int harmonics_amount = kDefaultHarmonics;
+  for(auto it : parsed_message){
+    harmonics_requested = HarmonicsAmountFromString(it, &harmonics_amount);
+    if(harmonics_requested)
+      break;
+  }
+  
   if((new_channel == stm32adc::kNoChannel) || (new_channel_mode == kNoMode)){
     stm32uart::SendMessage(assigned_uart_, "wrong parameters of start command");
     return;
   }
   
-  if(active_channels_.size() >= kMaxSimultaneouslyWorkingChannels){
-    stm32uart::SendMessage(assigned_uart_, "working channels limit reached (limit = " + std::to_string(kMaxSimultaneouslyWorkingChannels) + ")");
+  if(harmonics_requested && (new_channel_mode != kModeHarmonics)){
+    stm32uart::SendMessage(assigned_uart_, "harmonics amount is available in mode harm only");
     return;
   }
   
-  stm32adc::ReturnState add_channel_status = stm32adc::AddChannelToScanList(assigned_adc_, new_channel);
+  //window channels average raw samples themselves
+  if(oversampling_requested && (new_channel_mode != kModeInstant)){
+    stm32uart::SendMessage(assigned_uart_, "oversampling is available in mode none only");
+    return;
+  }
+  
+  //instant channel without oversampling is converted on request, it does not take a slot of scan list
+  const bool on_demand = (new_channel_mode == kModeInstant) && (!oversampling_requested);
+  
+  const int channels_limit = on_demand ? GetMemoryCapacity(new_channel_mode) : GetChannelsLimit(new_channel_mode);
+  
+  if(static_cast<int>(active_channels_.size()) >= channels_limit){
+    ResponseText response;
+    response.Text("working channels limit reached (limit = ").Signed(channels_limit).Symbol(')');
+    stm32uart::SendMessage(assigned_uart_, response);
+    return;
+  }
+  
+  //on-demand channel is not in scan list, so adc does not report it as active
+  if(active_channels_.find(new_channel) != active_channels_.end()){
+    SendChannelMessage(assigned_uart_, "ch", new_channel, " is already active");
+    return;
+  }
+  
+  stm32adc::ReturnState add_channel_status = stm32adc::kOk;
+  
+  //trial conversion checks, that channel is available and fits into sample period of scan list
+  if(on_demand){
+    AdcValue trial_value;
+    add_channel_status = stm32adc::ConvertChannelsOnce(assigned_adc_, &new_channel, 1, &trial_value);
+    if(add_channel_status == stm32adc::kRateNotAchievable)
+      add_channel_status = stm32adc::kChannelsLimitReached;
+  }
+  else {
+    add_channel_status = stm32adc::AddChannelToScanList(assigned_adc_, new_channel);
+  }
+  
+  if(add_channel_status == stm32adc::kChannelsLimitReached){
+    stm32uart::SendMessage(assigned_uart_, "adc is not able to scan more channels at current sample rate");
+    return;
+  }
   
   if(add_channel_status == stm32adc::kChannelAlreadyActive){
-    stm32uart::SendMessage(assigned_uart_, "ch" + std::to_string(new_channel) + " is already active");
+    SendChannelMessage(assigned_uart_, "ch", new_channel, " is already active");
     return;
   }
   
   if(add_channel_status != stm32adc::kOk){
-    stm32uart::SendMessage(assigned_uart_, "unable to start ch" + std::to_string(new_channel));
+    SendChannelMessage(assigned_uart_, "unable to start ch", new_channel, "");
     return;
   }
 
@@ -133,7 +313,8 @@ void Voltmeter::ProcessStartCommand(const ParamsList &parsed_message){
   case kModeInstant:
     channel_instance = std::make_unique<InstantVoltmeterChannel>( kDefaultVoltageAdcRangeMap, 
                                                                   assigned_adc_, 
-                                                                  new_channel);
+                                                                  new_channel,
+                                                                  oversampling_order);
     break;
   case kModeRMS:
     channel_instance = std::make_unique<RMSVoltmeterChannel>    ( kDefaultVoltageAdcRangeMap, 
@@ -150,13 +331,29 @@ void Voltmeter::ProcessStartCommand(const ParamsList &parsed_message){
                                                                   kDefaultMeasurementsAmount,
                                                                   kDefaultMeasurementsPeriod);
     break;
+  case kModeFrequency:
+    channel_instance = std::make_unique<FrequencyVoltmeterChannel>( kDefaultVoltageAdcRangeMap, 
+                                                                    assigned_adc_, 
+                                                                    new_channel);
+    break;
+  case kModeHarmonics:
+    channel_instance = std::make_unique<HarmonicsVoltmeterChannel>( kDefaultVoltageAdcRangeMap, 
+                                                                    assigned_adc_, 
+                                                                    new_channel,
+                                                                    harmonics_amount);
+    break;
   default:
     return;
   }
     
-  active_channels_.emplace(new_channel, std::move(channel_instance));
+  if(!active_channels_.emplace(new_channel, std::move(channel_instance)).second){
+    if(!on_demand)
+      stm32adc::RemoveChannelFromScanList(assigned_adc_, new_channel);
+    SendChannelMessage(assigned_uart_, "ch", new_channel, " is already active");
+    return;
+  }
   
-  stm32uart::SendMessage(assigned_uart_, "started ch " + std::to_string(new_channel));
+  SendChannelMessage(assigned_uart_, "started ch ", new_channel, "");
 }
 
 
@@ -177,10 +374,16 @@ void Voltmeter::ProcessStopCommand(const ParamsList &parsed_message){
     active_channels_.erase(new_channel);
   }
   
+  stm32adc::ClearChannelThresholds(assigned_adc_, new_channel);
+  if( hardware_alarm_set_ && (hardware_alarm_channel_ == new_channel) ){
+    stm32adc::ClearAnalogWatchdog(assigned_adc_);
+    hardware_alarm_set_ = false;
+  }
+  
   if( stm32adc::RemoveChannelFromScanList(assigned_adc_, new_channel) != stm32adc::kOk )
     return;
   
-  stm32uart::SendMessage(assigned_uart_, "ch " + std::to_string(new_channel) + " stopped");
+  SendChannelMessage(assigned_uart_, "ch ", new_channel, " stopped");
 }
 
 
@@ -208,19 +411,20 @@ void Voltmeter::ProcessResultCommand(const ParamsList &parsed_message){
     }
   }
   
-  std::string value = "";
-  const ReturnState get_value_status = GetChannelValue(channel, &value);
+  ResponseText response;
+  response.Text("ch").Unsigned(channel).Text(" value = ");
+  const ReturnState get_value_status = GetChannelValue(channel, &response);
   if(get_value_status == kError ){
-    stm32uart::SendMessage(assigned_uart_, "Ch" + std::to_string(channel) + " is not running");
+    SendChannelMessage(assigned_uart_, "Ch", channel, " is not running");
     return;
   }
   
   if(get_value_status == kNotEnoughMeasurements ){
-    stm32uart::SendMessage(assigned_uart_, "Ch" + std::to_string(channel) + " result is not yet ready");
+    SendChannelMessage(assigned_uart_, "Ch", channel, " result is not yet ready");
     return;
   }
   
-  stm32uart::SendMessage(assigned_uart_, "ch" + std::to_string(channel) + " value = " + value);
+  stm32uart::SendMessage(assigned_uart_, response);
   if(dump_requested)
     DumpChannelValues(channel);
 }
@@ -232,12 +436,45 @@ void Voltmeter::ProcessStatusCommand(const ParamsList &parsed_message){
     stm32uart::SendMessage(assigned_uart_, "Status: idle");
   }
   else{
-    std::string channels = "running channels:\n";
+    ResponseText channels;
+    //limit is reported for rms channels
+    channels.Text("running channels (limit = ").Signed(GetChannelsLimit(kModeRMS)).Text("):\n");
     for(auto it = active_channels_.begin(); it != active_channels_.end(); it++){
-      channels += "ch" + std::to_string(it->first) + " ";
+      channels.Text("ch").Unsigned(it->first).Symbol(' ');
     }
     stm32uart::SendMessage(assigned_uart_, channels);
   }
+  
+  ResponseText response;
+  
+  stm32adc::SupplyVoltage vdda = stm32adc::kNominalSupplyVoltage;
+  if( stm32adc::GetSupplyVoltage(assigned_adc_, &vdda) == stm32adc::kOk ){
+    response.Text("vdda = ").Unsigned(vdda).Text(" mV");
+    stm32uart::SendMessage(assigned_uart_, response);
+  }
+  
+  stm32adc::CalibrationStatistics calibration;
+  if( stm32adc::GetCalibrationStatistics(assigned_adc_, &calibration) == stm32adc::kOk ){
+    response.Clear();
+    response.Text("adc calibrations ").Unsigned(calibration.completed)
+            .Text(" (postponed ").Unsigned(calibration.postponed).Symbol(')')
+            .Text(", last ").Unsigned(calibration.last_duration_ns / 1000).Text(" us")
+            .Text(", max ").Unsigned(calibration.max_duration_ns / 1000).Text(" us")
+            .Text(", code ").Unsigned(calibration.calibration_code);
+    stm32uart::SendMessage(assigned_uart_, response);
+  }
+  
+  stm32adc::TimingStatistics timing;
+  if( (stm32adc::GetTimingStatistics(assigned_adc_, &timing) == stm32adc::kOk) && (timing.blocks > 0) ){
+    response.Clear();
+    response.Text("adc blocks ").Unsigned(timing.blocks)
+            .Text(" (gaps ").Unsigned(timing.gaps).Symbol(')')
+            .Text(", period ").Unsigned(timing.nominal_period_ns / 1000).Text(" us")
+            .Text(", jitter ").Unsigned(timing.max_period_ns - timing.min_period_ns).Text(" ns")
+            .Text(", latency ").Unsigned(timing.last_latency_ns / 1000).Text(" us")
+            .Text(" (max ").Unsigned(timing.max_latency_ns / 1000).Text(" us)");
+    stm32uart::SendMessage(assigned_uart_, response);
+  }
      
   if(errors_list_.empty()){
     stm32uart::SendMessage(assigned_uart_, "No errors");
@@ -253,9 +490,172 @@ void Voltmeter::ProcessStatusCommand(const ParamsList &parsed_message){
 }
 
 
-ReturnState Voltmeter::GetChannelValue(const stm32adc::AdcChannel channel, std::string *result_string){
-  result_string->clear();
+  //alarm <chN|all> <low V> <high V> [hw]     or     alarm <chN|all> off
+  //Channel alarm is served by software threshold engine, "hw" moves it to hardware watchdog.
+  //"all" is always served by hardware watchdog, which is one per Adc.
+  //Crossings are reported asynchronously as "alarm chN high 3.21V"
+void Voltmeter::ProcessAlarmCommand(const ParamsList &parsed_message){
+  
+  stm32adc::AdcChannel channel = stm32adc::kNoChannel;
+  bool all_channels = false;
+  bool hardware_requested = false;
+  bool off_requested = false;
+  Microvolts bounds[2] = {0, 0};
+  int bounds_amount = 0;
+  
+  for(auto it : parsed_message){
+    Microvolts voltage = 0;
+    if(it == "all")
+      all_channels = true;
+    else if(it == "hw")
+      hardware_requested = true;
+    else if(it == "off")
+      off_requested = true;
+    else if( VoltageFromString(it, &voltage) && (bounds_amount < 2) )
+      bounds[bounds_amount++] = voltage;
+    else if(channel == stm32adc::kNoChannel)
+      channel = AdcChannelFromString(it);
+  }
+  
+  if( all_channels == (channel != stm32adc::kNoChannel) ){
+    stm32uart::SendMessage(assigned_uart_, "wrong parameters of command alarm");
+    return;
+  }
+  
+  ResponseText target;
+  if(all_channels)
+    target.Text("all");
+  else
+    target.Text("ch").Unsigned(channel);
+  
+  ResponseText response;
+  
+  if(off_requested){
+    if(!all_channels)
+      stm32adc::ClearChannelThresholds(assigned_adc_, channel);
+    if( hardware_alarm_set_ && (all_channels || (hardware_alarm_channel_ == channel)) ){
+      stm32adc::ClearAnalogWatchdog(assigned_adc_);
+      hardware_alarm_set_ = false;
+    }
+    response.Text("alarm ").Text(target.Data(), target.Length()).Text(" off");
+    stm32uart::SendMessage(assigned_uart_, response);
+    return;
+  }
+  
+  AdcSample low_threshold = 0;
+  AdcSample high_threshold = 0;
+  if( (bounds_amount != 2) || (bounds[0] > bounds[1])
+      || (AdcThresholdFromVoltage(bounds[0], &low_threshold) != kOk)
+      || (AdcThresholdFromVoltage(bounds[1], &high_threshold) != kOk) ){
+    stm32uart::SendMessage(assigned_uart_, "wrong thresholds of command alarm");
+    return;
+  }
+  
+  if(!all_channels){
+    auto ch_it = active_channels_.find(channel);
+    if( (ch_it == active_channels_.end()) || (!ch_it->second->UsesScanList()) ){
+      response.Text(target.Data(), target.Length()).Text(" is not scanned");
+      stm32uart::SendMessage(assigned_uart_, response);
+      return;
+    }
+  }
+  
+  stm32adc::ReturnState set_status = stm32adc::kError;
+  if(all_channels || hardware_requested){
+    set_status = stm32adc::SetAnalogWatchdog(assigned_adc_, channel, low_threshold, high_threshold, AlarmHandler, nullptr);
+    hardware_alarm_set_ = (set_status == stm32adc::kOk);
+    hardware_alarm_channel_ = channel;
+  }
+  else{
+    set_status = stm32adc::SetChannelThresholds(assigned_adc_, channel, low_threshold, high_threshold, AlarmHandler, nullptr);
+  }
+  
+  if(set_status != stm32adc::kOk){
+    response.Text("failed to set alarm ").Text(target.Data(), target.Length());
+    stm32uart::SendMessage(assigned_uart_, response);
+    return;
+  }
+  
+  response.Text("alarm ").Text(target.Data(), target.Length()).Text(" set");
+  stm32uart::SendMessage(assigned_uart_, response);
+}
+
+
+  //Thresholds are compared with raw samples, so voltage is mapped back with current VDDA correction
+ReturnState Voltmeter::AdcThresholdFromVoltage(const Microvolts voltage, AdcSample *threshold){
+  
+  AdcLevel adc_level = 0;
+  if(kDefaultVoltageAdcRangeMap.GetAdcLevelByVoltage(voltage, &adc_level) == kError)
+    return kError;
+  
+  stm32adc::SupplyCorrection correction = stm32adc::kUnitySupplyCorrection;
+  stm32adc::GetSupplyCorrection(assigned_adc_, &correction);
+  if(correction == 0)
+    return kError;
+  
+  unsigned long long raw_level = ((unsigned long long) adc_level << stm32adc::kSupplyCorrectionShift) / correction;
+  raw_level = (raw_level + (1UL << (kAdcLevelShift - 1))) >> kAdcLevelShift;
+  
+  *threshold = (raw_level > stm32adc::kMaxAdcValue) ? stm32adc::kMaxAdcValue : static_cast<AdcSample>(raw_level);
+  return kOk;
+}
+
+
+  //Called from Adc interrupt: message is formatted in place and queued without allocation
+void Voltmeter::AlarmHandler(void*, const stm32adc::AdcChannel channel, 
+                             const stm32adc::ThresholdCrossing crossing, const AdcSample sample){
+  
+  stm32adc::SupplyCorrection correction = stm32adc::kUnitySupplyCorrection;
+  stm32adc::GetSupplyCorrection(assigned_adc_, &correction);
+  
+  const AdcLevel corrected_level = static_cast<AdcLevel>( MultiplyShift( (long long) sample << kAdcLevelShift, correction, 
+                                                                         stm32adc::kSupplyCorrectionShift ) );
+  Microvolts voltage = 0;
+  kDefaultVoltageAdcRangeMap.GetVoltageByAdcLevel(corrected_level, &voltage);
+  
+  stm32uart::TextBuffer<uart_configISR_MESSAGE_LENGTH> message;
+  message.Text("alarm ch").Unsigned(channel)
+         .Text( (crossing == stm32adc::kAboveHighThreshold) ? " high " : " low " )
+         .Fixed(voltage, 6, 2).Symbol('V');
+  
+  stm32uart::SendMessageFromIsr(assigned_uart_, message.Data(), message.Length());
+}
+
+
+  //Limit is not a constant: channel costs only its heap memory and one slot in Adc scan list, 
+  //the latter being limited by Adc conversion time at configured sample rate.
+  //Channels, converted on request, take no slot of scan list
+int Voltmeter::GetChannelsLimit(const ChannelMode mode){
   
+  int adc_capacity = 0;
+  if( stm32adc::GetChannelsCapacity(assigned_adc_, &adc_capacity) != stm32adc::kOk )
+    return active_channels_.size();
+  
+  for(auto it = active_channels_.begin(); it != active_channels_.end(); it++){
+    if(!it->second->UsesScanList())
+      adc_capacity++;
+  }
+  
+  return std::min(adc_capacity, GetMemoryCapacity(mode));
+}
+
+
+  //amount of channels, which fit into free heap, together with the running ones,
+  //when new channels are of given mode
+int Voltmeter::GetMemoryCapacity(const ChannelMode mode){
+  
+  const std::size_t free_heap = xPortGetFreeHeapSize();
+  int memory_capacity = active_channels_.size();
+  
+  if(free_heap > kHeapReserve)
+    memory_capacity += (free_heap - kHeapReserve) / ChannelHeapFootprint(mode);
+  
+  return memory_capacity;
+}
+
+
+ReturnState Voltmeter::GetChannelValue(const stm32adc::AdcChannel channel, stm32uart::TextFormatter *result_string){
+
   auto ch_it = active_channels_.find(channel);
   if(ch_it == active_channels_.end())
      return kError;
@@ -263,14 +663,7 @@ ReturnState Voltmeter::GetChannelValue(const stm32adc::AdcChannel channel, std::
   
   VoltmeterChannelPtr* this_channel = &(ch_it->second);
   
-  std::string raw_str = "";
-  ReturnState result_state = (*this_channel)->GetValue(&raw_str);
-  
-  int pt_index = raw_str.find(".");
-  
-  *result_string = raw_str.substr(0, pt_index + 5);
-  
-  return result_state; 
+  return (*this_channel)->GetValue(result_string);
 }
 
 
@@ -316,6 +709,9 @@ void Voltmeter::IncomingMessage(std::string new_message){
   case kStatusCommand:
     ProcessStatusCommand(parsed_message);
     break;
+  case kAlarmCommand:
+    ProcessAlarmCommand(parsed_message);
+    break;
   default:
     return;
   }
@@ -1,5 +1,7 @@
 //file voltmeter_channel.cpp
 
+#include <algorithm>
+
 #include "voltmeter_channel.h"
 
 namespace voltmeter{
@@ -13,30 +15,51 @@ namespace voltmeter{
 VoltageAdcRangeMap::VoltageAdcRangeMap(const AdcBounds &new_adc_bounds, const VoltageBounds &new_voltage_bounds) {
   adc_bounds_ = new_adc_bounds;
   voltage_bounds_ = new_voltage_bounds;
+  ComputeScale();
 }
 
 
 VoltageAdcRangeMap::VoltageAdcRangeMap(){
-  //nothing
+  scale_ = 0;
 }
 
 
 VoltageAdcRangeMap::VoltageAdcRangeMap(const VoltageAdcRangeMap &map_to_copy){
   adc_bounds_ = map_to_copy.adc_bounds_;
   voltage_bounds_ = map_to_copy.voltage_bounds_;
+  scale_ = map_to_copy.scale_;
+}
+
+
+VoltageAdcRangeMap& VoltageAdcRangeMap::operator=(const VoltageAdcRangeMap &map_to_copy){
+  adc_bounds_ = map_to_copy.adc_bounds_;
+  voltage_bounds_ = map_to_copy.voltage_bounds_;
+  scale_ = map_to_copy.scale_;
+  return *this;
 }
 
 
-ReturnState VoltageAdcRangeMap::GetVoltageByAdc(const AdcValue input_adc, Voltage* result_voltage){
+void VoltageAdcRangeMap::ComputeScale(){
+  const long long adc_bounds_diff = (long long) adc_bounds_.second - adc_bounds_.first;
+  const long long voltage_bounds_diff = (long long) voltage_bounds_.second - voltage_bounds_.first;
   
-  AdcValue adc_bounds_diff = adc_bounds_.second - adc_bounds_.first;
-  Voltage voltage_bounds_diff = voltage_bounds_.second - voltage_bounds_.first;
+  scale_ = (adc_bounds_diff == 0) ? 0 : (voltage_bounds_diff << kScaleShift) / adc_bounds_diff;
+}
+
+
+ReturnState VoltageAdcRangeMap::GetVoltageByAdc(const AdcValue input_adc, Microvolts* result_voltage) const{
+  return GetVoltageByAdcLevel(input_adc << kAdcLevelShift, result_voltage);
+}
+
+
+  //-adc_level- may be fractional (e.g. mean value of several samples)
+ReturnState VoltageAdcRangeMap::GetVoltageByAdcLevel(const AdcLevel adc_level, Microvolts* result_voltage) const{
   
-  if((adc_bounds_diff == 0) || (voltage_bounds_diff == 0))
+  if(scale_ == 0)
     return kError;
   
-  double coeff = (double) (input_adc - adc_bounds_.first) / adc_bounds_diff;
-  *result_voltage = voltage_bounds_.first + coeff * voltage_bounds_diff;
+  const long long level_offset = (long long) adc_level - ((long long) adc_bounds_.first << kAdcLevelShift);
+  *result_voltage = voltage_bounds_.first + MultiplyShift(level_offset, scale_, kAdcLevelShift + kScaleShift);
   
   if(*result_voltage < std::min(voltage_bounds_.first, voltage_bounds_.second)) 
     return kOutOfRange;
@@ -46,6 +69,38 @@ ReturnState VoltageAdcRangeMap::GetVoltageByAdc(const AdcValue input_adc, Voltag
   return kOk;
 }
 
+
+  //inverse of GetVoltageByAdcLevel(), levels below adc bounds are clamped to 0
+ReturnState VoltageAdcRangeMap::GetAdcLevelByVoltage(const Microvolts input_voltage, AdcLevel* result_adc_level) const{
+  
+  if(scale_ == 0)
+    return kError;
+  
+  const long long voltage_offset = (long long) input_voltage - voltage_bounds_.first;
+  const long long level = ((long long) adc_bounds_.first << kAdcLevelShift) 
+                          + (voltage_offset << (kAdcLevelShift + kScaleShift)) / scale_;
+  *result_adc_level = (level > 0) ? static_cast<AdcLevel>(level) : 0;
+  
+  if(input_voltage < std::min(voltage_bounds_.first, voltage_bounds_.second)) 
+    return kOutOfRange;
+  if(input_voltage > std::max(voltage_bounds_.first, voltage_bounds_.second))
+    return kOutOfRange;
+  
+  return kOk;
+}
+
+
+  //voltage difference, corresponding to difference of adc levels -adc_span- (no offset applied)
+Microvolts VoltageAdcRangeMap::GetVoltageSpan(const AdcLevel adc_span) const{
+  return static_cast<Microvolts>( MultiplyShift(adc_span, scale_, kAdcLevelShift + kScaleShift) );
+}
+
+
+  //voltage in volts with 4 digits after point, rounded
+static void AppendVoltage(stm32uart::TextFormatter *text, const Microvolts voltage){
+  text->Fixed(voltage, 6, 4);
+}
+
 // ===============================================================================================//
 /*            I VOLTMETER CHANNEL                                                                  */
 //===============================================================================================//
@@ -64,6 +119,22 @@ IVoltmeterChannel::~IVoltmeterChannel(){
   //nothing
 }
 
+void* IVoltmeterChannel::operator new(std::size_t size){
+  return pvPortMalloc(size);
+}
+
+void IVoltmeterChannel::operator delete(void* pointer){
+  vPortFree(pointer);
+}
+
+  //adc level, as if Adc were supplied with nominal voltage, which voltage map assumes
+  //Ratio of actual supply voltage (measured by stm32adc in background) to nominal one is ready, so it costs one multiply
+AdcLevel IVoltmeterChannel::CorrectAdcLevel(const AdcLevel adc_level) const{
+  stm32adc::SupplyCorrection correction = stm32adc::kUnitySupplyCorrection;
+  stm32adc::GetSupplyCorrection(adc_number_, &correction);
+  return static_cast<AdcLevel>( MultiplyShift(adc_level, correction, stm32adc::kSupplyCorrectionShift) );
+}
+
 ReturnState IVoltmeterChannel::TakeMeasurement(AdcValue *measurement){
   
   if( stm32adc::GetCurrentValue(adc_number_, channel_, measurement) != stm32adc::kOk )
@@ -72,60 +143,89 @@ ReturnState IVoltmeterChannel::TakeMeasurement(AdcValue *measurement){
   return kOk;
 }
 
+stm32adc::AdcHardwareNumber IVoltmeterChannel::GetAdcNumber() const{
+  return adc_number_;
+}
+
+stm32adc::AdcChannel IVoltmeterChannel::GetAdcChannel() const{
+  return channel_;
+}
+
 void IVoltmeterChannel::DumpValues(){
   stm32uart::SendMessage(stm32uart::kUart1, "Nothing to dump");
 }
+
+bool IVoltmeterChannel::UsesScanList() const{
+  return true;
+}
 // ===============================================================================================//
-/*            I FREE RTOS TIMER USAGE                                                          */
+/*            I ADC STREAM USAGE                                                                  */
 //===============================================================================================//
 
-std::map<TimerHandle_t, IVoltmeterChannel*> IFreeRtosTimerUsage::timers_map_ = {};
-
 
-IFreeRtosTimerUsage::IFreeRtosTimerUsage(){
-  timer_ = nullptr;
+IAdcStreamUsage::IAdcStreamUsage(){
+  subscriber_ = nullptr;
+  decimation_ = 1;
+  decimation_counter_ = 0;
+  measurement_interval_ = 0;
 }
 
 
-IFreeRtosTimerUsage::~IFreeRtosTimerUsage(){
-  ClearFreeRtosTimer();
-}
-
-void IFreeRtosTimerUsage::SetTimerHandle( const TimerHandle_t new_timer ){
-  timer_ = new_timer;
+IAdcStreamUsage::~IAdcStreamUsage(){
+  ClearAdcSubscription();
 }
 
 
-void IFreeRtosTimerUsage::FreeRtosTimerCallback( TimerHandle_t timer ){
+ReturnState IAdcStreamUsage::SubscribeToAdcStream( IVoltmeterChannel* subscriber, const TimeMs measurements_period ){
   
-  auto timer_it = timers_map_.find(timer);
+  stm32adc::SampleRate sample_rate = 0;
   
-  if(timer_it == timers_map_.end()){
-    return;
-  }
+  if( stm32adc::GetSampleRate(subscriber->GetAdcNumber(), &sample_rate) != stm32adc::kOk )
+    return kError;
   
-  IVoltmeterChannel* channel = timer_it->second;
+  decimation_ = (sample_rate * measurements_period) / configTICK_RATE_HZ;
+  if(decimation_ < 1)
+    decimation_ = 1;
+  decimation_counter_ = 0;
+  measurement_interval_ = static_cast<unsigned long>( (unsigned long long) stm32adc::GetTimestampFrequency() * decimation_ / sample_rate );
   
-  AdcValue new_measurement;
-  if(channel->TakeMeasurement(&new_measurement) != kOk){
-    return;
-  }
+  subscriber_ = subscriber;
   
-  if(channel->DropMeasurement(new_measurement) != kOk){
+  if( stm32adc::SubscribeToChannelSamples( subscriber_->GetAdcNumber(), 
+                                           subscriber_->GetAdcChannel(), 
+                                           AdcSamplesCallback, 
+                                           this ) != stm32adc::kOk ){
+    subscriber_ = nullptr;
+    return kError;
   }
   
+  return kOk;
+}
+
+
+void IAdcStreamUsage::AdcSamplesCallback( void* context, const stm32adc::ChannelSamples &samples ){
+  
+  IAdcStreamUsage* stream_usage = static_cast<IAdcStreamUsage*> (context);
+  
+  for(int i = 0; i < samples.amount; i++){
+    stream_usage->decimation_counter_++;
+    if(stream_usage->decimation_counter_ < stream_usage->decimation_)
+      continue;
+    
+    stream_usage->decimation_counter_ = 0;
+    stream_usage->subscriber_->DropMeasurement( samples.first[i * samples.stride], samples.timestamp + (Timestamp) i * samples.interval );
+  }
 }
 
 
-void IFreeRtosTimerUsage::ClearFreeRtosTimer(){
+void IAdcStreamUsage::ClearAdcSubscription(){
   
-  if( timers_map_.find(timer_) != timers_map_.end())
-    timers_map_.erase(timer_);
+  if(subscriber_ == nullptr)
+    return;
   
-  if(timer_ != nullptr)
-    xTimerDelete(timer_, portMAX_DELAY);  
+  stm32adc::UnsubscribeFromChannelSamples( subscriber_->GetAdcNumber(), subscriber_->GetAdcChannel(), this );
   
-  timer_ = nullptr;
+  subscriber_ = nullptr;
 }
 
 // ===============================================================================================//
@@ -134,8 +234,13 @@ void IFreeRtosTimerUsage::ClearFreeRtosTimer(){
 
 InstantVoltmeterChannel::InstantVoltmeterChannel(const VoltageAdcRangeMap &volt_adc_map,
                                                  const stm32adc::AdcHardwareNumber adc_number, 
-                                                 const stm32adc::AdcChannel channel) : IVoltmeterChannel(volt_adc_map, adc_number, channel) {
-  //nothing
+                                                 const stm32adc::AdcChannel channel,
+                                                 const stm32adc::OversamplingOrder oversampling_order) : IVoltmeterChannel(volt_adc_map, adc_number, channel) {
+  oversampling_order_ = 0;
+  on_demand_ = (oversampling_order == 0);
+  
+  if( (!on_demand_) && (stm32adc::SetChannelOversampling(adc_number_, channel_, oversampling_order) == stm32adc::kOk) )
+    oversampling_order_ = oversampling_order;
 }
 
 
@@ -144,112 +249,434 @@ InstantVoltmeterChannel::~InstantVoltmeterChannel(){
 }
 
 
-ReturnState InstantVoltmeterChannel::GetValue(std::string *value){
+ReturnState InstantVoltmeterChannel::GetValue(stm32uart::TextFormatter *value){
   
-  Voltage current_measurement;
-  AdcValue adc_value;
+  Microvolts current_measurement = 0;
+  AdcValue adc_value = stm32adc::kInvalidValue;
   
-  if( TakeMeasurement(&adc_value) != kOk )
-      return kError;
+  const stm32adc::ReturnState measurement_status = on_demand_ ? stm32adc::ConvertChannelsOnce(adc_number_, &channel_, 1, &adc_value)
+                                                              : stm32adc::GetCurrentValue(adc_number_, channel_, &adc_value);
+  
+  if(measurement_status == stm32adc::kValueNotReady)
+    return kNotEnoughMeasurements;
   
-  voltage_adc_range_map_.GetVoltageByAdc(adc_value, &current_measurement);
+  if(measurement_status != stm32adc::kOk)
+    return kError;
+  
+  //oversampled value is scaled back to 12-bit range, keeping its fractional part
+  const AdcLevel adc_level = CorrectAdcLevel( adc_value << (kAdcLevelShift - oversampling_order_) );
+  
+  voltage_adc_range_map_.GetVoltageByAdcLevel(adc_level, &current_measurement);
   
-  *value = std::to_string(current_measurement);
+  AppendVoltage(value, current_measurement);
   return kOk;
 }
 
 
-ReturnState InstantVoltmeterChannel::DropMeasurement(const AdcValue new_measurement){
+ReturnState InstantVoltmeterChannel::DropMeasurement(const AdcValue, const Timestamp){
   return kError;
 }
 
+
+bool InstantVoltmeterChannel::UsesScanList() const{
+  return !on_demand_;
+}
+
 // ===============================================================================================//
-/*            RMS VOLTMETER CHANNEL                                                               */
+/*            CROSSING DETECTOR                                                                   */
 //===============================================================================================//
 
-RMSVoltmeterChannel::RMSVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
-                                          const stm32adc::AdcHardwareNumber adc_number, 
-                                          const stm32adc::AdcChannel channel, 
-                                          const int measurements_amount,
-                                          const TimeMs measurements_period ) : IVoltmeterChannel(new_voltage_adc_map, adc_number, channel) {
-  measurements_ = {};
+  //time constant of mid level, 2^kMidLevelShift samples (85 ms at 3 kHz)
+constexpr int kMidLevelShift = 8;
+  //hysteresis is peak-to-peak / kHysteresisDivider, but not less than kMinHysteresis adc levels
+constexpr long kHysteresisDivider = 8;
+constexpr long kMinHysteresis = 16;
+
+CrossingDetector::CrossingDetector(){
+  Reset();
+}
+
+
+void CrossingDetector::Reset(){
+  mid_level_ = 0;
+  hysteresis_ = kMinHysteresis;
+  period_min_ = 0;
+  period_max_ = 0;
+  last_sample_ = 0;
+  last_timestamp_ = 0;
+  armed_ = false;
+  started_ = false;
+}
+
+
+  //called from Adc interrupt
+bool CrossingDetector::Feed(const AdcSample sample, const Timestamp timestamp, Timestamp *crossing_time){
+  
+  const long sample_level = (long) sample << kAdcLevelShift;
+  
+  if(!started_){
+    mid_level_ = sample_level;
+    period_min_ = sample;
+    period_max_ = sample;
+    last_sample_ = sample;
+    last_timestamp_ = timestamp;
+    started_ = true;
+    return false;
+  }
+  
+  mid_level_ += (sample_level - mid_level_) >> kMidLevelShift;
+  
+  if(sample < period_min_)
+    period_min_ = sample;
+  if(sample > period_max_)
+    period_max_ = sample;
+  
+  bool crossed = false;
+  
+  if( armed_ && (sample_level >= mid_level_) ){
+    //part of sample interval before mid level, 0..1 with kAdcLevelShift fractional bits
+    const long rise = (long) sample - last_sample_;
+    long fraction = (rise > 0) ? (mid_level_ - ((long) last_sample_ << kAdcLevelShift)) / rise : 0;
+    if(fraction < 0)
+      fraction = 0;
+    if(fraction > (1L << kAdcLevelShift))
+      fraction = 1L << kAdcLevelShift;
+    
+    *crossing_time = last_timestamp_ + ( ((timestamp - last_timestamp_) * fraction) >> kAdcLevelShift );
+    
+    hysteresis_ = (period_max_ - period_min_) / kHysteresisDivider;
+    if(hysteresis_ < kMinHysteresis)
+      hysteresis_ = kMinHysteresis;
+    period_min_ = sample;
+    period_max_ = sample;
+    
+    armed_ = false;
+    crossed = true;
+  }
+  else if( (!armed_) && (sample_level < mid_level_ - (hysteresis_ << kAdcLevelShift)) ){
+    armed_ = true;
+  }
+  
+  last_sample_ = sample;
+  last_timestamp_ = timestamp;
+  return crossed;
+}
+
+// ===============================================================================================//
+/*            I WINDOW VOLTMETER CHANNEL                                                          */
+//===============================================================================================//
+
+IWindowVoltmeterChannel::IWindowVoltmeterChannel( const VoltageAdcRangeMap &new_voltage_adc_map, 
+                                                  const stm32adc::AdcHardwareNumber adc_number, 
+                                                  const stm32adc::AdcChannel channel, 
+                                                  const int measurements_amount,
+                                                  const TimeMs measurements_period ) : IVoltmeterChannel(new_voltage_adc_map, adc_number, channel) {
   required_measurements_amount_ = measurements_amount;
+  if(required_measurements_amount_ < 1)
+    required_measurements_amount_ = 1;
+  if(required_measurements_amount_ > ChannelWindow::Capacity() - kSpareSamples)
+    required_measurements_amount_ = ChannelWindow::Capacity() - kSpareSamples;
+  
   measurements_period_ = measurements_period;
-  timer_ = xTimerCreate (  "",
-                           measurements_period_,
-                           pdTRUE,
-                           (void *) 0,
-                           FreeRtosTimerCallback );
+  sum_ = 0;
+  sum_of_squares_ = 0;
+  last_timestamp_ = 0;
+  window_restarts_ = 0;
+  
+  last_crossing_ = 0;
+  crossing_seen_ = false;
+  signal_period_ = 0;
+  period_outliers_ = 0;
+  coherent_periods_ = 0;
+  coherent_length_ = 0;
+  coherent_fraction_ = 0;
+  coherent_sum_ = 0;
+  coherent_sum_of_squares_ = 0;
   
-  IFreeRtosTimerUsage::timers_map_.emplace(timer_, static_cast<IVoltmeterChannel*> (this));
-  xTimerStart(timer_, portMAX_DELAY);
+  SubscribeToAdcStream(this, measurements_period_);
 }
 
 
-RMSVoltmeterChannel::~RMSVoltmeterChannel(){
-  //nothing to do
+IWindowVoltmeterChannel::~IWindowVoltmeterChannel(){
+  ClearAdcSubscription();
 }
 
 
-ReturnState RMSVoltmeterChannel::GetValue(std::string *value){
-  value->clear();
+  //called from Adc interrupt
+ReturnState IWindowVoltmeterChannel::DropMeasurement(const AdcValue new_measurement, const Timestamp timestamp){
   
-  xTimerStop(timer_, portMAX_DELAY);
+  //sample is more than half of interval away from its time
+  if( (!measurements_.Empty()) && (measurement_interval_ > 0) ){
+    const Timestamp expected_timestamp = last_timestamp_ + measurement_interval_;
+    const Timestamp deviation = (timestamp > expected_timestamp) ? timestamp - expected_timestamp : expected_timestamp - timestamp;
+    if(deviation > measurement_interval_ / 2){
+      measurements_.Clear();
+      sum_ = 0;
+      sum_of_squares_ = 0;
+      coherent_sum_ = 0;
+      coherent_sum_of_squares_ = 0;
+      detector_.Reset();
+      crossing_seen_ = false;
+      window_restarts_++;
+    }
+  }
+  last_timestamp_ = timestamp;
   
-  if(measurements_.size() < required_measurements_amount_){
-    xTimerStart(timer_, portMAX_DELAY);
-    return kNotEnoughMeasurements;
+  //the oldest sample leaves the window, spare samples are not in its sums
+  if(measurements_.Size() >= required_measurements_amount_ + kSpareSamples)
+    measurements_.PopFront();
+  
+  measurements_.PushBack( static_cast<AdcSample>(new_measurement) );
+  
+  sum_ += new_measurement;
+  sum_of_squares_ += (unsigned long) new_measurement * new_measurement;
+  if(measurements_.Size() > required_measurements_amount_){
+    const AdcSample leaving = measurements_[measurements_.Size() - 1 - required_measurements_amount_];
+    sum_ -= leaving;
+    sum_of_squares_ -= (unsigned long) leaving * leaving;
   }
-    
- int max_val = 0;
-  int min_val = stm32adc::kMaxAdcValue;
-  
-  for(auto measurement_it : measurements_){
-    if(measurement_it > max_val)
-      max_val = measurement_it;
-    if(measurement_it < min_val)
-      min_val = measurement_it;    
+  
+  //the same for coherent span, which is not longer than the window
+  coherent_sum_ += new_measurement;
+  coherent_sum_of_squares_ += (unsigned long) new_measurement * new_measurement;
+  if(measurements_.Size() > coherent_length_){
+    const AdcSample leaving = measurements_[measurements_.Size() - 1 - coherent_length_];
+    coherent_sum_ -= leaving;
+    coherent_sum_of_squares_ -= (unsigned long) leaving * leaving;
   }
   
-  int mid_val = (max_val + min_val) / 2;
-  int rms_val = (int) ((max_val - mid_val) * 0.7071);
-  Voltage result = 0;
+  UpdateSignalPeriod(static_cast<AdcSample>(new_measurement), timestamp);
   
-  if(voltage_adc_range_map_.GetVoltageByAdc(rms_val, &result) != kOk)
-      return kError;
+  return kOk;  
+}
 
-  *value = std::to_string(result);
+
+  //measured period, which differs from current estimate more than 1/kPeriodTolerance, is outlier (e.g. noise crossing)
+  //kMaxPeriodOutliers outliers in a row mean, that frequency has changed
+constexpr unsigned long kPeriodTolerance = 4;
+constexpr int kMaxPeriodOutliers = 2;
+  //estimate follows measured periods with weight 1/2^kPeriodSmoothingShift
+constexpr int kPeriodSmoothingShift = 2;
+
+  //called from Adc interrupt
+void IWindowVoltmeterChannel::UpdateSignalPeriod(const AdcSample sample, const Timestamp timestamp){
   
-  xTimerReset(timer_, portMAX_DELAY);
+  Timestamp crossing_time = 0;
+  if( !detector_.Feed(sample, timestamp, &crossing_time) ){
+    //no crossing during the whole window: input is DC or is lost
+    if( crossing_seen_ && (timestamp - last_crossing_ > (Timestamp) required_measurements_amount_ * measurement_interval_) ){
+      crossing_seen_ = false;
+      signal_period_ = 0;
+      UpdateCoherentSpan();
+    }
+    return;
+  }
   
-  return kOk;  
+  const bool period_measured = crossing_seen_;
+  const Timestamp period = crossing_time - last_crossing_;
+  last_crossing_ = crossing_time;
+  crossing_seen_ = true;
+  
+  if( (!period_measured) || (period > (Timestamp) required_measurements_amount_ * measurement_interval_) )
+    return;
+  
+  const unsigned long measured_period = static_cast<unsigned long>(period);
+  const unsigned long difference = (measured_period > signal_period_) ? measured_period - signal_period_ : signal_period_ - measured_period;
+  
+  if( (signal_period_ == 0) || (period_outliers_ >= kMaxPeriodOutliers) )
+    signal_period_ = measured_period;
+  else if(difference > signal_period_ / kPeriodTolerance){
+    period_outliers_++;
+    return;
+  }
+  else if(measured_period > signal_period_)
+    signal_period_ += difference >> kPeriodSmoothingShift;
+  else
+    signal_period_ -= difference >> kPeriodSmoothingShift;
+  
+  period_outliers_ = 0;
+  UpdateCoherentSpan();
 }
 
 
-ReturnState RMSVoltmeterChannel::DropMeasurement(const AdcValue new_measurement){
+  //the largest whole number of periods, which fits the window
+  //Half of sample is tolerated, so that estimate noise does not drop a period from window of exact whole periods
+void IWindowVoltmeterChannel::UpdateCoherentSpan(){
   
-  while(measurements_.size() >= required_measurements_amount_)
-    measurements_.pop_front();
+  const unsigned long long window_span = (unsigned long long) required_measurements_amount_ * measurement_interval_ + measurement_interval_ / 2;
   
-  measurements_.push_back(new_measurement);
+  coherent_periods_ = ( (signal_period_ == 0) || (measurement_interval_ == 0) ) ? 0 : static_cast<int>(window_span / signal_period_);
+  if(coherent_periods_ == 0){
+    SetCoherentLength(0);
+    coherent_fraction_ = 0;
+    return;
+  }
   
-  return kOk;  
+  const unsigned long long span = ( ((unsigned long long) coherent_periods_ * signal_period_) << kWindowWeightShift ) / measurement_interval_;
+  SetCoherentLength( static_cast<int>(span >> kWindowWeightShift) );
+  coherent_fraction_ = static_cast<unsigned long>( span & ((1UL << kWindowWeightShift) - 1) );
 }
 
-void RMSVoltmeterChannel::DumpValues(){
-  int i = 0;
-  stm32uart::SendMessage(stm32uart::kUart1, "Ch" + std::to_string(channel_) + "dump:");
-  Voltage current_measurement = 0;
+
+  //coherent sums follow the length, samples are added or removed at the older end
+void IWindowVoltmeterChannel::SetCoherentLength(const int length){
   
-  xTimerStop(timer_, portMAX_DELAY);
+  while(coherent_length_ < length){
+    if(coherent_length_ < measurements_.Size()){
+      const AdcSample joining = measurements_[measurements_.Size() - 1 - coherent_length_];
+      coherent_sum_ += joining;
+      coherent_sum_of_squares_ += (unsigned long) joining * joining;
+    }
+    coherent_length_++;
+  }
   
-  for(auto it : measurements_){
-    voltage_adc_range_map_.GetVoltageByAdc(it, &current_measurement);
-    stm32uart::SendMessage(stm32uart::kUart1, "[" + std::to_string(i) + "] = " + std::to_string(it)); 
-    i++;
+  while(coherent_length_ > length){
+    coherent_length_--;
+    if(coherent_length_ < measurements_.Size()){
+      const AdcSample leaving = measurements_[measurements_.Size() - 1 - coherent_length_];
+      coherent_sum_ -= leaving;
+      coherent_sum_of_squares_ -= (unsigned long) leaving * leaving;
+    }
   }
+}
+
+
+  //returns false, if window is not yet full
+  //Coherent span of L = M + f samples is integrated by trapezoids over linearly interpolated samples:
+  //the newest sample has weight 1/2, the next M - 1 ones - 1, 
+  //two older ones (M-th and (M + 1)-th) share the rest: 1/2 + f - f^2/2 and f^2/2
+bool IWindowVoltmeterChannel::TakeWindowStatistics(WindowStatistics *statistics){
   
-  xTimerReset(timer_, portMAX_DELAY);
+  constexpr unsigned long kHalf = 1UL << (kWindowWeightShift - 1);
+  
+  taskENTER_CRITICAL();
+  const int size = measurements_.Size();
+  statistics->amount = (size < required_measurements_amount_) ? size : required_measurements_amount_;
+  statistics->periods = 0;
+  
+  if( (coherent_periods_ > 0) && (size >= coherent_length_ + kSpareSamples) ){
+    const unsigned long fraction = coherent_fraction_;
+    const unsigned long tail_weight = (fraction * fraction) >> (kWindowWeightShift + 1);
+    const unsigned long end_weight = kHalf + fraction - tail_weight;
+    
+    const unsigned long long newest = measurements_[size - 1];
+    const unsigned long long end = measurements_[size - 1 - coherent_length_];
+    const unsigned long long tail = measurements_[size - 2 - coherent_length_];
+    
+    statistics->periods = coherent_periods_;
+    statistics->weight = ((unsigned long) coherent_length_ << kWindowWeightShift) + fraction;
+    statistics->sum = ((unsigned long long) coherent_sum_ << kWindowWeightShift) 
+                      - kHalf * newest + end_weight * end + tail_weight * tail;
+    statistics->sum_of_squares = (coherent_sum_of_squares_ << kWindowWeightShift) 
+                                 - kHalf * newest * newest + end_weight * end * end + tail_weight * tail * tail;
+  }
+  else{
+    statistics->weight = (unsigned long) statistics->amount << kWindowWeightShift;
+    statistics->sum = (unsigned long long) sum_ << kWindowWeightShift;
+    statistics->sum_of_squares = sum_of_squares_ << kWindowWeightShift;
+  }
+  taskEXIT_CRITICAL();
+  
+  return statistics->amount >= required_measurements_amount_;
+}
+
+
+void IWindowVoltmeterChannel::DumpValues(){
+  ResponseText response;
+  response.Text("Ch").Unsigned(channel_).Text("dump:");
+  stm32uart::SendMessage(stm32uart::kUart1, response);
+  
+  AdcSample snapshot[kChannelWindowCapacity];
+  
+  taskENTER_CRITICAL();
+  const int spare_amount = (measurements_.Size() > required_measurements_amount_) ? measurements_.Size() - required_measurements_amount_ : 0;
+  const int snapshot_size = measurements_.Size() - spare_amount;
+  for(int index = 0; index < snapshot_size; index++)
+    snapshot[index] = measurements_[spare_amount + index];
+  const unsigned long window_restarts = window_restarts_;
+  const int coherent_periods = coherent_periods_;
+  const unsigned long coherent_span = ((unsigned long) coherent_length_ << kWindowWeightShift) + coherent_fraction_;
+  taskEXIT_CRITICAL();
+  
+  //window span by timestamps of its samples, which are contiguous
+  const unsigned long long span_us = (snapshot_size == 0) ? 0 
+                                   : (unsigned long long) (snapshot_size - 1) * measurement_interval_ * 1000000ULL / stm32adc::GetTimestampFrequency();
+  response.Clear();
+  response.Text("window span ").Unsigned(span_us).Text(" us, restarts ").Unsigned(window_restarts);
+  stm32uart::SendMessage(stm32uart::kUart1, response);
+  
+  response.Clear();
+  if(coherent_periods == 0)
+    response.Text("coherent window off");
+  else
+    response.Text("coherent window ").Signed(coherent_periods).Text(" periods, ")
+            .Fixed( ((unsigned long long) coherent_span * 100) >> kWindowWeightShift, 2, 2 ).Text(" samples");
+  stm32uart::SendMessage(stm32uart::kUart1, response);
+  
+  for(int i = 0; i < snapshot_size; i++){
+    response.Clear();
+    response.Symbol('[').Signed(i).Text("] = ").Unsigned(snapshot[i]);
+    stm32uart::SendMessage(stm32uart::kUart1, response); 
+  }
+}
+
+// ===============================================================================================//
+/*            RMS VOLTMETER CHANNEL                                                               */
+//===============================================================================================//
+
+RMSVoltmeterChannel::RMSVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
+                                          const stm32adc::AdcHardwareNumber adc_number, 
+                                          const stm32adc::AdcChannel channel, 
+                                          const int measurements_amount,
+                                          const TimeMs measurements_period ) : IWindowVoltmeterChannel(new_voltage_adc_map, 
+                                                                                                       adc_number, 
+                                                                                                       channel, 
+                                                                                                       measurements_amount, 
+                                                                                                       measurements_period) {
+  //nothing
+}
+
+
+RMSVoltmeterChannel::~RMSVoltmeterChannel(){
+  //nothing to do
+}
+
+
+ReturnState RMSVoltmeterChannel::GetValue(stm32uart::TextFormatter *value){
+  
+  WindowStatistics statistics;
+  
+  if( !TakeWindowStatistics(&statistics) )
+    return kNotEnoughMeasurements;
+  
+  const unsigned long long weight = statistics.weight;
+  const AdcLevel mean_level = static_cast<AdcLevel>( (statistics.sum << kAdcLevelShift) / weight );
+  
+  //weight^2 * variance is exact in integers: weight * sum of squares - sum^2
+  const unsigned long long sum_squared = statistics.sum * statistics.sum;
+  const unsigned long long scaled_variance = weight * statistics.sum_of_squares;
+  const unsigned long long variance_numerator = (scaled_variance > sum_squared) ? scaled_variance - sum_squared : 0;
+  
+  //its root is weight * AC level; some fractional bits are taken before root, as many as 64 bits allow
+  constexpr int kRootFractionShift = (kAdcLevelShift - kWindowWeightShift) / 2;
+  const AdcLevel ac_level = static_cast<AdcLevel>( (IntegerSqrt(variance_numerator << (2 * kRootFractionShift)) << (kAdcLevelShift - kRootFractionShift)) / weight );
+  
+  Microvolts dc_voltage = 0;
+  
+  if(voltage_adc_range_map_.GetVoltageByAdcLevel(CorrectAdcLevel(mean_level), &dc_voltage) == kError)
+      return kError;
+  
+  const Microvolts ac_voltage = voltage_adc_range_map_.GetVoltageSpan( CorrectAdcLevel(ac_level) );
+  const Microvolts rms_voltage = static_cast<Microvolts>( IntegerSqrt( (long long) dc_voltage * dc_voltage + (long long) ac_voltage * ac_voltage ) );
+
+  value->Text("rms ");
+  AppendVoltage(value, rms_voltage);
+  value->Text(" dc ");
+  AppendVoltage(value, dc_voltage);
+  value->Text(" ac ");
+  AppendVoltage(value, ac_voltage);
+  
+  return kOk;  
 }
 
 // ===============================================================================================//
@@ -260,17 +687,12 @@ AverageVoltmeterChannel::AverageVoltmeterChannel( const VoltageAdcRangeMap &new_
                                                   const stm32adc::AdcHardwareNumber adc_number, 
                                                   const stm32adc::AdcChannel channel, 
                                                   const int measurements_amount,
-                                                  const TimeMs measurements_period ) : IVoltmeterChannel(new_voltage_adc_map, adc_number, channel) {
-  required_measurements_amount_ = measurements_amount;
-  measurements_period_ = measurements_period;
-  timer_ = xTimerCreate (  "",
-                           measurements_period_,
-                           pdTRUE,
-                           (void *) 0,
-                           FreeRtosTimerCallback );
-  
-  IFreeRtosTimerUsage::timers_map_.emplace(timer_, static_cast<IVoltmeterChannel*> (this));
-  xTimerStart(timer_, portMAX_DELAY);
+                                                  const TimeMs measurements_period ) : IWindowVoltmeterChannel(new_voltage_adc_map, 
+                                                                                                               adc_number, 
+                                                                                                               channel, 
+                                                                                                               measurements_amount, 
+                                                                                                               measurements_period) {
+  //nothing
 }
 
 
@@ -279,67 +701,445 @@ AverageVoltmeterChannel::~AverageVoltmeterChannel(){
 }
 
 
-ReturnState AverageVoltmeterChannel::GetValue(std::string *value){
-  value->clear();
+ReturnState AverageVoltmeterChannel::GetValue(stm32uart::TextFormatter *value){
+  
+  WindowStatistics statistics;
+  
+  if( !TakeWindowStatistics(&statistics) )
+    return kNotEnoughMeasurements;
+  
+  const AdcLevel mean_level = static_cast<AdcLevel>( (statistics.sum << kAdcLevelShift) / statistics.weight );
+  Microvolts result = 0;
+  
+  if(voltage_adc_range_map_.GetVoltageByAdcLevel(CorrectAdcLevel(mean_level), &result) == kError)
+      return kError;
+
+  AppendVoltage(value, result);
+  
+  return kOk;    
+}
+
+// ===============================================================================================//
+/*            FREQUENCY VOLTMETER CHANNEL                                                         */
+//===============================================================================================//
+
+  //range of measured frequency
+constexpr unsigned long kMinFrequencyHz = 10;
+constexpr unsigned long kMaxFrequencyHz = 400;
+  //every sample of Adc stream is taken, so that crossings are interpolated between close samples
+constexpr TimeMs kFrequencyMeasurementsPeriod = 0;
+
+FrequencyVoltmeterChannel::FrequencyVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
+                                                     const stm32adc::AdcHardwareNumber adc_number, 
+                                                     const stm32adc::AdcChannel channel) : IVoltmeterChannel(new_voltage_adc_map, adc_number, channel) {
+  min_period_ = stm32adc::GetTimestampFrequency() / kMaxFrequencyHz;
+  max_period_ = stm32adc::GetTimestampFrequency() / kMinFrequencyHz;
+  last_crossing_ = 0;
+  last_timestamp_ = 0;
+  crossing_seen_ = false;
+  restarts_ = 0;
   
-  xTimerStop(timer_, portMAX_DELAY);
+  SubscribeToAdcStream(this, kFrequencyMeasurementsPeriod);
+}
+
+
+FrequencyVoltmeterChannel::~FrequencyVoltmeterChannel(){
+  ClearAdcSubscription();
+}
+
+
+void FrequencyVoltmeterChannel::Restart(){
+  detector_.Reset();
+  periods_.Clear();
+  crossing_seen_ = false;
+  restarts_++;
+}
 
-  //DumpMeasurements();
 
-  if(measurements_.size() < required_measurements_amount_){
-    xTimerStart(timer_, portMAX_DELAY);
+  //called from Adc interrupt
+ReturnState FrequencyVoltmeterChannel::DropMeasurement(const AdcValue new_measurement, const Timestamp timestamp){
+  
+  //samples were lost, crossing might be among them
+  if( (last_timestamp_ != 0) && (measurement_interval_ > 0) ){
+    const Timestamp expected_timestamp = last_timestamp_ + measurement_interval_;
+    const Timestamp deviation = (timestamp > expected_timestamp) ? timestamp - expected_timestamp : expected_timestamp - timestamp;
+    if(deviation > measurement_interval_ / 2)
+      Restart();
+  }
+  last_timestamp_ = timestamp;
+  
+  Timestamp crossing_time = 0;
+  if( !detector_.Feed(static_cast<AdcSample>(new_measurement), timestamp, &crossing_time) ){
+    //signal is lost (or below hysteresis)
+    if( crossing_seen_ && (timestamp - last_crossing_ > max_period_) )
+      Restart();
+    return kOk;
+  }
+  
+  if(crossing_seen_){
+    const Timestamp period = crossing_time - last_crossing_;
+    if( (period < min_period_) || (period > max_period_) )
+      periods_.Clear();
+    else
+      periods_.PushBack( static_cast<unsigned long>(period) );
+  }
+  
+  last_crossing_ = crossing_time;
+  crossing_seen_ = true;
+  return kOk;
+}
+
+
+ReturnState FrequencyVoltmeterChannel::GetValue(stm32uart::TextFormatter *value){
+  
+  unsigned long snapshot[kFrequencyPeriodsCapacity];
+  
+  taskENTER_CRITICAL();
+  const int amount = periods_.Size();
+  for(int index = 0; index < amount; index++)
+    snapshot[index] = periods_[index];
+  taskEXIT_CRITICAL();
+  
+  if(amount < kFrequencyPeriodsCapacity)
     return kNotEnoughMeasurements;
+  
+  unsigned long long periods_sum = 0;
+  unsigned long min_period = snapshot[0];
+  unsigned long max_period = snapshot[0];
+  for(int index = 0; index < amount; index++){
+    periods_sum += snapshot[index];
+    if(snapshot[index] < min_period)
+      min_period = snapshot[index];
+    if(snapshot[index] > max_period)
+      max_period = snapshot[index];
+  }
+  
+  //mean frequency over all periods, in 0.01 Hz
+  const unsigned long long timestamp_frequency = stm32adc::GetTimestampFrequency();
+  const unsigned long long centihertz = ( (unsigned long long) amount * timestamp_frequency * 100 + periods_sum / 2 ) / periods_sum;
+  const unsigned long long jitter_ns = (unsigned long long) (max_period - min_period) * 1000000000ULL / timestamp_frequency;
+  
+  value->Text("freq ").Fixed(centihertz, 2, 2).Text(" Hz jitter ").Fixed(jitter_ns, 3, 1).Text(" us");
+  
+  return kOk;
+}
+
+
+void FrequencyVoltmeterChannel::DumpValues(){
+  ResponseText response;
+  response.Text("Ch").Unsigned(channel_).Text("dump:");
+  stm32uart::SendMessage(stm32uart::kUart1, response);
+  
+  unsigned long snapshot[kFrequencyPeriodsCapacity];
+  
+  taskENTER_CRITICAL();
+  const int snapshot_size = periods_.Size();
+  for(int index = 0; index < snapshot_size; index++)
+    snapshot[index] = periods_[index];
+  const unsigned long restarts = restarts_;
+  taskEXIT_CRITICAL();
+  
+  response.Clear();
+  response.Text("restarts ").Unsigned(restarts);
+  stm32uart::SendMessage(stm32uart::kUart1, response);
+  
+  //periods in microseconds
+  for(int i = 0; i < snapshot_size; i++){
+    response.Clear();
+    response.Symbol('[').Signed(i).Text("] = ")
+            .Fixed( (unsigned long long) snapshot[i] * 1000000000ULL / stm32adc::GetTimestampFrequency(), 3, 1 ).Text(" us");
+    stm32uart::SendMessage(stm32uart::kUart1, response); 
   }
+}
+
+
+// ===============================================================================================//
+/*            HARMONICS VOLTMETER CHANNEL                                                         */
+//===============================================================================================//
+
+  //block is as many periods, as fit kTargetBlockSamples (at least one), longer blocks are restarted
+constexpr int kTargetBlockSamples = 512;
+constexpr int kMaxBlockSamples = 1024;
+  //bounds of fundamental period, samples: at least two samples per period of the highest analysed harmonic, 
+  //and filter states must fit in 64 bits at the longest period
+constexpr unsigned long kMinPeriodSamples = 4;
+constexpr unsigned long kMaxPeriodSamples = 256;
+  //filter states have kGoertzelStateShift fractional bits
+constexpr int kGoertzelStateShift = 4;
+  //every sample of Adc stream is taken, harmonics up to the 15th are to be below Nyquist frequency
+constexpr TimeMs kHarmonicsMeasurementsPeriod = 0;
+
+HarmonicsVoltmeterChannel::HarmonicsVoltmeterChannel(const VoltageAdcRangeMap &new_voltage_adc_map, 
+                                                     const stm32adc::AdcHardwareNumber adc_number, 
+                                                     const stm32adc::AdcChannel channel,
+                                                     const int harmonics_amount) : IVoltmeterChannel(new_voltage_adc_map, adc_number, channel) {
+  harmonics_amount_ = harmonics_amount;
+  if(harmonics_amount_ < 1)
+    harmonics_amount_ = 1;
+  if(harmonics_amount_ > kMaxHarmonics)
+    harmonics_amount_ = kMaxHarmonics;
+  active_harmonics_ = 0;
+  
+  last_crossing_ = 0;
+  last_timestamp_ = 0;
+  crossing_seen_ = false;
   
-  int max_val = 0;
-  int min_val = stm32adc::kMaxAdcValue;
+  block_running_ = false;
+  block_periods_ = 1;
+  periods_in_block_ = 0;
+  block_samples_ = 0;
+  block_start_ = 0;
+  block_sum_ = 0;
+  dc_level_ = 0;
+  dc_known_ = false;
   
-  for(auto measurement_it : measurements_){
-    if(measurement_it > max_val)
-      max_val = measurement_it;
-    if(measurement_it < min_val)
-      min_val = measurement_it;    
+  result_ready_ = false;
+  restarts_ = 0;
+  
+  SubscribeToAdcStream(this, kHarmonicsMeasurementsPeriod);
+}
+
+
+HarmonicsVoltmeterChannel::~HarmonicsVoltmeterChannel(){
+  ClearAdcSubscription();
+}
+
+
+void HarmonicsVoltmeterChannel::Restart(){
+  detector_.Reset();
+  crossing_seen_ = false;
+  block_running_ = false;
+  dc_known_ = false;
+  result_ready_ = false;
+  restarts_++;
+}
+
+
+  //filters are tuned to harmonics of fundamental with given -period-, CPU cycles
+void HarmonicsVoltmeterChannel::StartBlock(const Timestamp start_time, const Timestamp period){
+  
+  block_running_ = false;
+  if( (measurement_interval_ == 0) 
+      || (period < (Timestamp) kMinPeriodSamples * measurement_interval_) 
+      || (period > (Timestamp) kMaxPeriodSamples * measurement_interval_) )
+    return;
+  
+  block_periods_ = static_cast<int>( (Timestamp) kTargetBlockSamples * measurement_interval_ / period );
+  if(block_periods_ < 1)
+    block_periods_ = 1;
+  
+  //fundamental, radians per sample, not more than pi/2
+  const long long omega = static_cast<long long>( (unsigned long long) kTwoPi * measurement_interval_ / period );
+  
+  active_harmonics_ = harmonics_amount_;
+  while( (active_harmonics_ > 1) && (active_harmonics_ * omega >= kPi) )
+    active_harmonics_--;
+  
+  //the rest by recurrence: cos((h + 1)w) = 2 cos(w) cos(hw) - cos((h - 1)w), the same for sin
+  SineCosine(omega, &filters_[0].sine, &filters_[0].cosine);
+  long long previous_cosine = 1LL << kAngleShift;
+  long long previous_sine = 0;
+  
+  for(int harmonic = 1; harmonic < active_harmonics_; harmonic++){
+    filters_[harmonic].cosine = ((filters_[0].cosine * filters_[harmonic - 1].cosine) >> (kAngleShift - 1)) - previous_cosine;
+    filters_[harmonic].sine = ((filters_[0].cosine * filters_[harmonic - 1].sine) >> (kAngleShift - 1)) - previous_sine;
+    previous_cosine = filters_[harmonic - 1].cosine;
+    previous_sine = filters_[harmonic - 1].sine;
   }
   
-  int mid_val = (max_val + min_val) / 2;
-  Voltage result = 0;
+  for(int harmonic = 0; harmonic < active_harmonics_; harmonic++){
+    filters_[harmonic].state = 0;
+    filters_[harmonic].previous_state = 0;
+  }
   
-  if(voltage_adc_range_map_.GetVoltageByAdc(mid_val, &result) != kOk)
-      return kError;
+  block_start_ = start_time;
+  periods_in_block_ = 0;
+  block_samples_ = 0;
+  block_sum_ = 0;
+  block_running_ = true;
+}
 
-  *value = std::to_string(result);
+
+  //DFT value of harmonic is s[N-1] - exp(-jw) * s[N-2]
+  //Result of the first block is dropped, as DC level was not yet known for it
+void HarmonicsVoltmeterChannel::FinishBlock(const Timestamp end_time){
   
-  xTimerReset(timer_, portMAX_DELAY);
+  block_running_ = false;
+  if(block_samples_ == 0)
+    return;
   
-  return kOk;    
+  if(dc_known_){
+    for(int harmonic = 0; harmonic < active_harmonics_; harmonic++){
+      const GoertzelFilter &filter = filters_[harmonic];
+      result_.real[harmonic] = filter.state - ((filter.cosine * filter.previous_state) >> kAngleShift);
+      result_.imaginary[harmonic] = (filter.sine * filter.previous_state) >> kAngleShift;
+    }
+    result_.harmonics = active_harmonics_;
+    result_.samples = block_samples_;
+    result_.periods = block_periods_;
+    result_.duration = end_time - block_start_;
+    result_ready_ = true;
+  }
+  
+  dc_level_ = static_cast<long>( ((unsigned long long) block_sum_ << kGoertzelStateShift) / block_samples_ );
+  dc_known_ = true;
 }
 
 
-ReturnState AverageVoltmeterChannel::DropMeasurement(const AdcValue new_measurement){
-  while(measurements_.size() >= required_measurements_amount_)
-    measurements_.pop_front();
+  //called from Adc interrupt
+ReturnState HarmonicsVoltmeterChannel::DropMeasurement(const AdcValue new_measurement, const Timestamp timestamp){
+  
+  //samples were lost, block is not contiguous
+  if( (last_timestamp_ != 0) && (measurement_interval_ > 0) ){
+    const Timestamp expected_timestamp = last_timestamp_ + measurement_interval_;
+    const Timestamp deviation = (timestamp > expected_timestamp) ? timestamp - expected_timestamp : expected_timestamp - timestamp;
+    if(deviation > measurement_interval_ / 2)
+      Restart();
+  }
+  last_timestamp_ = timestamp;
   
-  measurements_.push_back(new_measurement);
+  const AdcSample sample = static_cast<AdcSample>(new_measurement);
+  Timestamp crossing_time = 0;
   
-  return kOk;    
+  if( detector_.Feed(sample, timestamp, &crossing_time) ){
+    if(block_running_){
+      periods_in_block_++;
+      if(periods_in_block_ >= block_periods_){
+        const Timestamp period = (crossing_time - block_start_) / block_periods_;
+        FinishBlock(crossing_time);
+        StartBlock(crossing_time, period);
+      }
+    }
+    else if(crossing_seen_){
+      StartBlock(crossing_time, crossing_time - last_crossing_);
+    }
+    last_crossing_ = crossing_time;
+    crossing_seen_ = true;
+  }
+  else if( crossing_seen_ && (timestamp - last_crossing_ > (Timestamp) kMaxPeriodSamples * measurement_interval_) ){
+    //signal is lost
+    Restart();
+    return kOk;
+  }
+  
+  if(!block_running_)
+    return kOk;
+  
+  //s[n] = x[n] + 2 cos(w) s[n-1] - s[n-2]
+  const long long input = ((long long) sample << kGoertzelStateShift) - dc_level_;
+  for(int harmonic = 0; harmonic < active_harmonics_; harmonic++){
+    GoertzelFilter &filter = filters_[harmonic];
+    const long long state = input + ((filter.cosine * filter.state) >> (kAngleShift - 1)) - filter.previous_state;
+    filter.previous_state = filter.state;
+    filter.state = state;
+  }
+  
+  block_sum_ += sample;
+  block_samples_++;
+  if(block_samples_ > kMaxBlockSamples)
+    Restart();
+  
+  return kOk;
 }
 
 
-void AverageVoltmeterChannel::DumpValues(){
-  int i = 0;
-  stm32uart::SendMessage(stm32uart::kUart1, "Ch" + std::to_string(channel_) + "dump:");
-  Voltage current_measurement = 0;
+bool HarmonicsVoltmeterChannel::TakeResult(HarmonicsBlock *result){
+  taskENTER_CRITICAL();
+  const bool result_ready = result_ready_;
+  if(result_ready)
+    *result = result_;
+  taskEXIT_CRITICAL();
   
-  xTimerStop(timer_, portMAX_DELAY);
+  return result_ready && (result->harmonics > 0) && (result->duration > 0);
+}
+
+
+  //magnitude of DFT value, its phase, amplitude of harmonic (2 * magnitude / N) in volts
+static unsigned long long HarmonicMagnitude(const HarmonicsBlock &block, const int harmonic){
+  return IntegerSqrt( (unsigned long long) (block.real[harmonic] * block.real[harmonic]) 
+                      + (unsigned long long) (block.imaginary[harmonic] * block.imaginary[harmonic]) );
+}
+
+static long long HarmonicPhase(const HarmonicsBlock &block, const int harmonic){
+  return Atan2(block.imaginary[harmonic], block.real[harmonic]);
+}
+
+static AdcLevel AmplitudeLevel(const unsigned long long magnitude, const int samples){
+  return static_cast<AdcLevel>( (magnitude << (kAdcLevelShift + 1 - kGoertzelStateShift)) / samples );
+}
+
+
+  //"freq 50.00 Hz h1 1.2345 V thd 3.21%", h1 is peak amplitude of fundamental
+ReturnState HarmonicsVoltmeterChannel::GetValue(stm32uart::TextFormatter *value){
   
-  for(auto it : measurements_){
-    voltage_adc_range_map_.GetVoltageByAdc(it, &current_measurement);
-    stm32uart::SendMessage(stm32uart::kUart1, "[" + std::to_string(i) + "] = " + std::to_string(it)); 
-    i++;
+  HarmonicsBlock block;
+  if(!TakeResult(&block))
+    return kNotEnoughMeasurements;
+  
+  const unsigned long long fundamental = HarmonicMagnitude(block, 0);
+  if(fundamental == 0)
+    return kNotEnoughMeasurements;
+  
+  unsigned long long harmonics_energy = 0;
+  for(int harmonic = 1; harmonic < block.harmonics; harmonic++){
+    const unsigned long long magnitude = HarmonicMagnitude(block, harmonic);
+    harmonics_energy += magnitude * magnitude;
   }
   
-  xTimerReset(timer_, portMAX_DELAY);
+  //in 0.01 %
+  const unsigned long long thd = (IntegerSqrt(harmonics_energy) * 10000 + fundamental / 2) / fundamental;
+  const unsigned long long centihertz = ( (unsigned long long) block.periods * stm32adc::GetTimestampFrequency() * 100 + block.duration / 2 ) / block.duration;
+  const Microvolts amplitude = voltage_adc_range_map_.GetVoltageSpan( CorrectAdcLevel(AmplitudeLevel(fundamental, block.samples)) );
+  
+  value->Text("freq ").Fixed(centihertz, 2, 2).Text(" Hz h1 ").Fixed(amplitude, 6, 4)
+        .Text(" V thd ").Fixed(thd, 2, 2).Symbol('%');
+  
+  return kOk;
 }
+
+
+  //"h3 0.1234 V 10.00% 30.0 deg": peak amplitude, ratio to fundamental, phase to fundamental
+  //Phase of harmonic h to fundamental is phase(h) - h * phase(1), it does not depend on block start
+void HarmonicsVoltmeterChannel::DumpValues(){
+  ResponseText response;
+  response.Text("Ch").Unsigned(channel_).Text("dump:");
+  stm32uart::SendMessage(stm32uart::kUart1, response);
+  
+  HarmonicsBlock block;
+  const bool block_ready = TakeResult(&block);
   
+  taskENTER_CRITICAL();
+  const unsigned long restarts = restarts_;
+  taskEXIT_CRITICAL();
   
+  response.Clear();
+  response.Text("restarts ").Unsigned(restarts);
+  if(block_ready)
+    response.Text(", block ").Signed(block.samples).Text(" samples, ").Signed(block.periods).Text(" periods");
+  stm32uart::SendMessage(stm32uart::kUart1, response);
+  
+  if(!block_ready)
+    return;
+  
+  const unsigned long long fundamental = HarmonicMagnitude(block, 0);
+  const long long fundamental_phase = HarmonicPhase(block, 0);
+  
+  for(int harmonic = 0; harmonic < block.harmonics; harmonic++){
+    const unsigned long long magnitude = HarmonicMagnitude(block, harmonic);
+    const Microvolts amplitude = voltage_adc_range_map_.GetVoltageSpan( CorrectAdcLevel(AmplitudeLevel(magnitude, block.samples)) );
+    const unsigned long long ratio = (fundamental == 0) ? 0 : (magnitude * 10000 + fundamental / 2) / fundamental;
+    
+    long long phase = (HarmonicPhase(block, harmonic) - (harmonic + 1) * fundamental_phase) % kTwoPi;
+    if(phase > kPi)
+      phase -= kTwoPi;
+    if(phase <= -kPi)
+      phase += kTwoPi;
+    
+    response.Clear();
+    response.Symbol('h').Signed(harmonic + 1).Symbol(' ').Fixed(amplitude, 6, 4).Text(" V ")
+            .Fixed(ratio, 2, 2).Text("% ").Fixed(phase * 1800 / kPi, 1, 1).Text(" deg");
+    stm32uart::SendMessage(stm32uart::kUart1, response);
+  }
+}
+
 }               //namespace voltmeter
\ No newline at end of file